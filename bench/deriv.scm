@@ -0,0 +1,33 @@
+;;; deriv: symbolic differentiation, cond dispatch on symbols and list
+;;; construction with map
+
+(define (caddr x) (car (cddr x)))
+
+(define (deriv a)
+  (cond ((not (pair? a))
+         (if (eq? a 'x) 1 0))
+        ((eq? (car a) '+)
+         (cons '+ (map deriv (cdr a))))
+        ((eq? (car a) '-)
+         (cons '- (map deriv (cdr a))))
+        ((eq? (car a) '*)
+         (list '* a (cons '+ (map deriv-aux (cdr a)))))
+        ((eq? (car a) '/)
+         (list '-
+               (list '/ (deriv (cadr a)) (caddr a))
+               (list '/ (cadr a) (list '* (caddr a) (caddr a) (deriv (caddr a))))))
+        (else (error "deriv: no derivation method"))))
+
+(define (deriv-aux a)
+  (list '/ (deriv a) a))
+
+(define (size t)
+  (if (pair? t) (+ (size (car t)) (size (cdr t))) 1))
+
+(define (run n k)
+  (if (= n 0)
+      k
+      (run (- n 1) (deriv '(+ (* 3 x x) (* a x x) (* b x) 5)))))
+
+(if (not (= (size (run 20000 #f)) 61))
+    (error "deriv: wrong result"))
@@ -0,0 +1,72 @@
+;;; destruct: Gabriel's destructive list benchmark, set-car! and set-cdr! on
+;;; a churning structure of lists
+
+(define (make-nils n)
+  (define (loop i a)
+    (if (= i 0) a (loop (- i 1) (cons '() a))))
+  (loop n '()))
+
+(define (len l)
+  (define (loop l n)
+    (if (null? l) n (loop (cdr l) (+ n 1))))
+  (loop l 0))
+
+(define (last-pair l)
+  (if (null? (cdr l)) l (last-pair (cdr l))))
+
+(define (append-to-tail! x y)
+  (if (null? x)
+      y
+      (begin (set-cdr! (last-pair x) y) x)))
+
+;; stores i in the first j cells of a and returns the cell after them
+(define (fill! a j i)
+  (if (= j 0)
+      a
+      (begin (set-car! a i) (fill! (cdr a) (- j 1) i))))
+
+;; stores i in the first j - 1 cells of a and cuts the list after the j-th
+(define (cut! a j i)
+  (if (= j 1)
+      (let ((x (cdr a)))
+        (set-cdr! a '())
+        x)
+      (begin (set-car! a i) (cut! (cdr a) (- j 1) i))))
+
+(define (grow! l m)
+  (if (not (null? l))
+      (begin
+        (if (null? (car l))
+            (set-car! l (cons '() '())))
+        (append-to-tail! (car l) (make-nils m))
+        (grow! (cdr l) m))))
+
+(define (shuffle! l1 l2 i)
+  (if (not (null? l2))
+      (begin
+        (set-cdr! (fill! (car l2) (/ (len (car l2)) 2) i)
+                  (let ((n (/ (len (car l1)) 2)))
+                    (if (= n 0)
+                        (begin (set-car! l1 '()) (car l1))
+                        (cut! (car l1) n i))))
+        (shuffle! (cdr l1) (cdr l2) i))))
+
+(define (destructive n m)
+  (define l (make-nils 10))
+  (define (loop i)
+    (if (= i 0)
+        l
+        (begin
+          (if (null? (car l))
+              (grow! l m)
+              (shuffle! l (cdr l) i))
+          (loop (- i 1)))))
+  (loop n))
+
+(define (repeat n thunk)
+  (if (= n 1)
+      (thunk)
+      (begin (thunk) (repeat (- n 1) thunk))))
+
+(if (not (= (len (repeat 5 (lambda () (destructive 600 50)))) 10))
+    (error "destruct: wrong result"))
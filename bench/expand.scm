@@ -0,0 +1,69 @@
+;;; expand: macro expansion of forms full of let, cond, case, and, or and a
+;;; user macro, then an expression evaluator over association lists
+
+(define (caddr x) (car (cddr x)))
+
+(define-syntax swap!
+  (lambda (args)
+    `(let ((tmp ,(car args)))
+       (set! ,(car args) ,(cadr args))
+       (set! ,(cadr args) tmp))))
+
+(define form
+  '(lambda (x y)
+     (let ((a (+ x 1))
+           (b (- y 1)))
+       (cond ((and (< a b) (or (= a 0) (= b 0)))
+              (case a
+                ((1 2 3) 'small)
+                ((4 5 6) 'medium)
+                (else 'large)))
+             ((or (< a 0) (and (> b 10) (< b 20)))
+              (let ((c (* a b)))
+                (if (> c 100) 'big 'little)))
+             (else
+              (unless (= a b) (swap! a b))
+              (list a b))))))
+
+(define (expand-n n k)
+  (if (= n 0)
+      k
+      (expand-n (- n 1) (expand form))))
+
+(define (lookup key alist)
+  (cond ((null? alist) (error "expand: unbound variable"))
+        ((eq? (caar alist) key) (cdar alist))
+        (else (lookup key (cdr alist)))))
+
+(define (ev e env)
+  (cond ((symbol? e) (lookup e env))
+        ((pair? e)
+         (case (car e)
+           ((+) (+ (ev (cadr e) env) (ev (caddr e) env)))
+           ((-) (- (ev (cadr e) env) (ev (caddr e) env)))
+           ((*) (* (ev (cadr e) env) (ev (caddr e) env)))
+           ((let) (ev (caddr e)
+                      (cons (cons (car (cadr e)) (ev (cadr (cadr e)) env)) env)))
+           (else (error "expand: bad expression"))))
+        (else e)))
+
+(define (make-env n env)
+  (if (= n 0)
+      env
+      (make-env (- n 1) (cons (cons (gensym) n) env))))
+
+(define env
+  (cons (cons 'x 3) (cons (cons 'y 4) (make-env 100 '()))))
+
+(define expr
+  '(let (z (* x y))
+     (+ (- z x) (let (w (+ z y)) (* w (- w z))))))
+
+(define (ev-n n k)
+  (if (= n 0)
+      k
+      (ev-n (- n 1) (+ k (ev expr env)))))
+
+(expand-n 2000 #f)
+(if (not (= (ev-n 20000 0) (* 20000 73)))
+    (error "expand: wrong result"))
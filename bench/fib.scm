@@ -0,0 +1,9 @@
+;;; fib: doubly recursive Fibonacci, closure calls and fixnum arithmetic
+
+(define (fib n)
+  (if (< n 2)
+      n
+      (+ (fib (- n 1)) (fib (- n 2)))))
+
+(if (not (= (fib 28) 317811))
+    (error "fib: wrong result"))
@@ -0,0 +1,7 @@
+;;; load: reads, expands and evaluates big.scm, a large generated file of
+;;; definitions and quoted data that run.sh writes to the current directory
+
+(load "big.scm")
+
+(if (not (= (f19999 3) 40004))
+    (error "load: wrong result"))
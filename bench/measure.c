@@ -0,0 +1,83 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <err.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/*
+ * measure RUNS COMMAND [ARG...]
+ *
+ * Runs COMMAND RUNS times with stdin and stdout on /dev/null and prints the
+ * median wall time in seconds and the peak resident set size of any run in
+ * kilobytes, separated by a tab. Exits nonzero if any run fails.
+ */
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int by_value(const void *a, const void *b) {
+  double x = *(const double *) a, y = *(const double *) b;
+  return (x > y) - (x < y);
+}
+
+static double run(char **argv) {
+  double start = now();
+  pid_t pid = fork();
+  if (pid == -1) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    int null = open("/dev/null", O_RDWR);
+    if (null == -1 || dup2(null, 0) == -1 || dup2(null, 1) == -1) {
+      err(1, "failed to redirect to /dev/null");
+    }
+    execvp(argv[0], argv);
+    err(127, "%s", argv[0]);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) == -1) {
+    err(1, "waitpid");
+  }
+  double elapsed = now() - start;
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    errx(1, "%s failed", argv[0]);
+  }
+  return elapsed;
+}
+
+int main(int argc, char **argv) {
+  int runs = argc > 2 ? atoi(argv[1]) : 0;
+  if (runs < 1) {
+    fprintf(stderr, "usage: %s RUNS COMMAND [ARG...]\n", argv[0]);
+    return 2;
+  }
+
+  double *times = malloc(runs * sizeof(*times));
+  if (!times) {
+    err(1, "malloc");
+  }
+  for (int i = 0; i < runs; i++) {
+    times[i] = run(argv + 2);
+  }
+  qsort(times, runs, sizeof(*times), by_value);
+  double median = runs % 2 ? times[runs / 2] : (times[runs / 2 - 1] + times[runs / 2]) / 2;
+
+  /* the largest ru_maxrss of any child waited for, in kilobytes on Linux */
+  struct rusage usage;
+  if (getrusage(RUSAGE_CHILDREN, &usage) == -1) {
+    err(1, "getrusage");
+  }
+  printf("%.4f\t%ld\n", median, usage.ru_maxrss);
+  free(times);
+  return 0;
+}
@@ -0,0 +1,36 @@
+;;; nqueens: counts the solutions of the eight queens problem, list
+;;; allocation and short-lived conses
+
+(define (iota1 n)
+  (define (loop i l)
+    (if (= i 0) l (loop (- i 1) (cons i l))))
+  (loop n '()))
+
+(define (append2 xs ys)
+  (if (null? xs) ys (cons (car xs) (append2 (cdr xs) ys))))
+
+(define (ok? row dist placed)
+  (if (null? placed)
+      #t
+      (and (not (= (car placed) (+ row dist)))
+           (not (= (car placed) (- row dist)))
+           (ok? row (+ dist 1) (cdr placed)))))
+
+(define (try x y z)
+  (if (null? x)
+      (if (null? y) 1 0)
+      (+ (if (ok? (car x) 1 z)
+             (try (append2 (cdr x) y) '() (cons (car x) z))
+             0)
+         (try (cdr x) (cons (car x) y) z))))
+
+(define (queens n)
+  (try (iota1 n) '() '()))
+
+(define (repeat n thunk)
+  (if (= n 1)
+      (thunk)
+      (begin (thunk) (repeat (- n 1) thunk))))
+
+(if (not (= (repeat 20 (lambda () (queens 8))) 92))
+    (error "nqueens: wrong result"))
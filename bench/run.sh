@@ -0,0 +1,77 @@
+#!/bin/sh
+#
+# bench/run.sh PONZI MEASURE [BASELINE]
+#
+# Runs each workload in bench/ RUNS times (5 by default) under both engines
+# and prints a tab-separated table of the median wall time in seconds and
+# the peak RSS in kilobytes. Given the table of an earlier run as BASELINE,
+# adds its median and the ratio of the new median to it.
+
+set -e
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 PONZI MEASURE [BASELINE]" >&2
+  exit 2
+fi
+
+abspath() {
+  case $1 in
+    /*) echo "$1" ;;
+    *) echo "$PWD/$1" ;;
+  esac
+}
+
+ponzi=$(abspath "$1")
+measure=$(abspath "$2")
+baseline=${3:+$(abspath "$3")}
+bench=$(cd "$(dirname "$0")" && pwd)
+lib=$(dirname "$bench")/lib.scm
+runs=${RUNS:-5}
+workloads=${WORKLOADS:-"tak fib nqueens deriv destruct strings expand load"}
+
+# the workloads write and load scratch files in the current directory
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+cd "$scratch"
+
+awk 'BEGIN {
+  for (i = 0; i < 20000; i++) {
+    printf "(define (f%d x)\n  (let ((y (+ x %d)))\n    (cond ((< y 0) (quote negative))\n          (else (* y 2)))))\n", i, i
+    printf "(define d%d (quote (%d \"item %d\" #\\x (%d . sym-%d) #(%d %d) (nested (list (of things))))))\n", i, i, i, i, i, i, i + 1
+  }
+}' > big.scm
+
+if [ -n "$baseline" ]; then
+  printf 'benchmark\tengine\tmedian_s\tpeak_rss_kb\tbaseline_s\tratio\n'
+else
+  printf 'benchmark\tengine\tmedian_s\tpeak_rss_kb\n'
+fi
+
+for w in $workloads; do
+  for engine in eval vm; do
+    flag=
+    if [ $engine = vm ]; then
+      flag=--vm
+    fi
+    result=$("$measure" "$runs" "$ponzi" $flag "$lib" "$bench/$w.scm")
+    if [ -n "$baseline" ]; then
+      printf '%s\t%s\t%s\n' "$w" "$engine" "$result" | awk -F '\t' -v OFS='\t' -v base="$baseline" '
+        BEGIN {
+          while ((getline line < base) > 0) {
+            split(line, f, "\t")
+            median[f[1] "\t" f[2]] = f[3]
+          }
+        }
+        {
+          old = median[$1 "\t" $2]
+          if (old > 0) {
+            print $0, old, sprintf("%.3f", $3 / old)
+          } else {
+            print $0, "-", "-"
+          }
+        }'
+    else
+      printf '%s\t%s\t%s\n' "$w" "$engine" "$result"
+    fi
+  done
+done
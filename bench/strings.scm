@@ -0,0 +1,56 @@
+;;; strings: writes numbered lines through a port character by character,
+;;; reads them back as strings and scans and rewrites them in place
+
+(define digits (vector #\0 #\1 #\2 #\3 #\4 #\5 #\6 #\7 #\8 #\9))
+
+(define (write-number n port)
+  (if (< n 10)
+      (write-char (vector-ref digits n) port)
+      (begin
+        (write-number (/ n 10) port)
+        (write-char (vector-ref digits (- n (* 10 (/ n 10)))) port))))
+
+(define (write-lines i n port)
+  (if (< i n)
+      (begin
+        (write-string "item-" port)
+        (write-number i port)
+        (write-char #\newline port)
+        (write-lines (+ i 1) n port))))
+
+;; counts the c's in s, replacing them with r
+(define (replace! s c r)
+  (define (loop i k)
+    (if (= i (string-len s))
+        k
+        (if (eq? (string-ref s i) c)
+            (begin (string-set! s i r) (loop (+ i 1) (+ k 1)))
+            (loop (+ i 1) k))))
+  (loop 0 0))
+
+(define (scan-lines port k)
+  (let ((line (read-line port)))
+    (if (null? line)
+        k
+        (scan-lines port (+ k (replace! line #\1 #\x))))))
+
+(define (scan-chunks port k)
+  (let ((chunk (read-string 64 port)))
+    (if (null? chunk)
+        k
+        (scan-chunks port (+ k (replace! chunk #\newline #\space))))))
+
+(define out (open-file "strings.tmp" #\w))
+(write-lines 0 40000 out)
+(close-file out)
+
+(define in (open-file "strings.tmp" #\r))
+(define ones (scan-lines in 0))
+(close-file in)
+
+(define in (open-file "strings.tmp" #\r))
+(define lines (scan-chunks in 0))
+(close-file in)
+
+(if (not (and (= ones 26000) (= lines 40000)))
+    (error "strings: wrong result"))
@@ -0,0 +1,16 @@
+;;; tak: Takeuchi's function, deep non-tail recursion on fixnums
+
+(define (tak x y z)
+  (if (not (< y x))
+      z
+      (tak (tak (- x 1) y z)
+           (tak (- y 1) z x)
+           (tak (- z 1) x y))))
+
+(define (repeat n thunk)
+  (if (= n 1)
+      (thunk)
+      (begin (thunk) (repeat (- n 1) thunk))))
+
+(if (not (= (repeat 10 (lambda () (tak 18 12 6))) 7))
+    (error "tak: wrong result"))
@@ -1,29 +1,17 @@
 (define (not b)
   (if b #f #t))
 
-(define = eq?)
-(define char=? =)
+(define = eqv?)
+(define char=? eqv?)
 
 (define (caar x) (car (car x)))
 (define (cadr x) (car (cdr x)))
 (define (cdar x) (cdr (car x)))
 (define (cddr x) (cdr (cdr x)))
 
-(define (box x) (cons 'box x))
-(define (unbox x) (cdr x))
-(define (set-box! box val) (set-cdr! box val))
-
-(define macros (box '()))
-
-(define (push-macro! name expander)
-  (set-box! macros (cons (cons name expander) (unbox macros))))
-
-(define (lookup-macro-in symbol table)
-  (if (null? table)
-      #f
-      (if (= (caar table) symbol)
-        (cdar table)
-        (lookup-macro-in symbol (cdr table)))))
+(define (box x) (make-vector 1 x))
+(define (unbox x) (vector-ref x 0))
+(define (set-box! box val) (vector-set! box 0 val))
 
 (define (make-lambda args body)
   (cons 'lambda (cons args body)))
@@ -34,18 +22,10 @@
       (cons (f (car x))
             (map f (cdr x)))))
 
-(push-macro! 'let
-  (lambda (macro-arguments)
-    ((lambda (args vals body)
-       (cons (make-lambda args body) vals))
-     (map car (car macro-arguments))
-     (map cadr (car macro-arguments))
-     (cdr macro-arguments))))
-
 (define (member x xs)
   (if (null? xs)
       #f
-      (if (= (car xs) x)
+      (if (equal? (car xs) x)
           #t
           (member x (cdr xs)))))
 
@@ -56,35 +36,6 @@
         (cons (car xs) (append (cdr xs) ys)))
     (cons xs ys)))
 
-(define (expand/helper shadow s)
-  (if (if (pair? s)
-        (if (symbol? (car s))
-          (not (member (car s) shadow))
-          #f)
-        #f)
-   (if (eq? (car s) 'quote)
-     s
-     (if (eq? (car s) 'lambda)
-       (make-lambda (cadr s)
-                    (expand/helper (append (cadr s) shadow)
-                                   (cddr s)))
-       ((lambda (m-entry)
-          (if m-entry
-            (expand/helper shadow (m-entry (cdr s)))
-            (cons (expand/helper shadow (car s))
-                  (expand/helper shadow (cdr s)))))
-        (lookup-macro-in (car s) (unbox macros)))))
-   (if (pair? s)
-     (cons (expand/helper shadow (car s))
-           (expand/helper shadow (cdr s)))
-     s)))
-
-(define (expand s)
-  (expand/helper '() s))
-
-(define (apply-macro-expander f xs)
-  (eval (cons f (map (lambda (x) (list 'quote x)) xs)) (environment)))
-
 (push-macro! 'define-syntax
   (lambda (macro-arguments)
     (let ((name (car macro-arguments))
@@ -96,7 +47,7 @@
             'push-macro!
             (list 'quote name)
             (make-lambda (list 'macro-arguments)
-                         (list (list 'apply-macro-expander (make-lambda args body)
+                         (list (list 'apply (make-lambda args body)
                                      'macro-arguments)))))
         (list 'push-macro! (list 'quote name) (car body))))))
 
@@ -123,7 +74,7 @@
 
 (define (quasiquote/helper expr)
   (if (and (pair? expr)
-           (= 'unquote (car expr)))
+           (eq? 'unquote (car expr)))
     (cadr expr)
     (if (pair? expr)
       (list 'cons
@@ -137,10 +88,6 @@
       (quasiquote/helper (car args))
       (error "bad quasiquote"))))
 
-(define-syntax begin
-  (lambda (body)
-    `(,(make-lambda '() body))))
-
 (define-syntax unless
   (lambda (macro-arguments)
     (let ((condition (car macro-arguments))
@@ -153,82 +100,9 @@
           (body (cdr macro-arguments)))
       `(if ,condition #f (begin . ,body)))))
 
-(define (cond-expand exprs)
-  (if (and (pair? exprs) (not (null? exprs))
-           (pair? (car exprs)))
-      (if (eq? (caar exprs) 'else)
-        `(,(make-lambda '() (cdar exprs)))
-        `(if ,(caar exprs)
-             (,(make-lambda '() (cdar exprs)))
-             ,(cond-expand (cdr exprs))))
-      (if (null? exprs) '#f)))
-
-(push-macro! 'cond cond-expand)
-
-(define (case-expand macro-arguments)
-  (define (make-case-conditional var tests)
-    (if (null? tests)
-      #f
-      (if (pair? tests)
-          `(or (eq? ,var (quote ,(car tests)))
-             ,(make-case-conditional var (cdr tests)))
-          `(eq? ,var (quote ,tests)))))
-  (define (expand-cases var exprs)
-    (if (and (pair? exprs) (not (null? exprs))
-             (pair? (car exprs)))
-        (if (eq? (caar exprs) 'else)
-          `(,(make-lambda '() (cdar exprs)))
-          (let ((condition
-                  (make-case-conditional var (caar exprs))))
-            `(if ,condition
-                 (,(make-lambda '() (cdar exprs)))
-                 ,(expand-cases var (cdr exprs)))))
-        (if (null? exprs) '#f)))
-  (let ((var (gensym))
-        (case-argument (car macro-arguments))
-        (case-body (cdr macro-arguments)))
-    `(let ((,var ,case-argument))
-       ,(expand-cases var case-body))))
-
-(push-macro! 'case case-expand)
-
-(define (set!-helper env symbol value)
-  (cond
-    ((and (not (null? env))
-          (eq? (caar env) symbol))
-     (set-cdr! (car env) value))
-    ((not (null? env))
-     (set!-helper (cdr env) symbol value))
-    (else
-      (write "no existing binding for " symbol))))
-
-(define-syntax (set! symbol value)
-  `(set!-helper (environment) ',symbol ,value))
-
-(define-syntax letrec
-  (lambda (macro-arguments)
-    (define (make-set entry)
-      `(set! ,(car entry) (lambda ,(cadr entry) . ,(cddr entry))))
-    (let ((definitions (car macro-arguments))
-          (body (cdr macro-arguments)))
-      (cons (make-lambda (map car definitions)
-                         (append (map make-set definitions)
-                                 body))
-        (map (lambda () 'letrec-unbound-definition) definitions)))))
-
 (define (push! list value)
   (set-cdr! list (cons value (cdr list))))
 
-(define write-string
-  (lambda args
-    (define (write-chars port len i str)
-      (if (>= i len)
-        #t
-        (and
-          (write-char (string-ref str i) port)
-          (write-chars port len (+ 1 i) str))))
-    (if (and (pair? args)
-             (pair? (cdr args)))
-      (let ((string (car args)))
-        (write-chars (cadr args) (string-len string) 0 string))
-      (write (car args)))))
+(define-syntax time
+  (lambda (macro-arguments)
+    `(time-apply (lambda () ,(car macro-arguments)))))
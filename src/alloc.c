@@ -1,28 +1,260 @@
 #include "scheme.h"
+#include "hashtab.h"
+#include "port.h"
+#include "stats.h"
 
-scm_object *new(enum obj_tag tag) {
-  scm_object *o = malloc(sizeof(scm_object));
-  if (!o) {
-    err(1, "failed to allocate memory for object of tag %s", tag_str(tag));
+/*
+ * The heap is a set of chunks of fixed-size cells. Free cells are threaded
+ * through their `fwd` field; the collector is a non-moving mark & sweep that
+ * traces the registered roots precisely and the C stack conservatively, so
+ * that any cell still referenced by a live `eval` frame stays put.
+ */
+
+#define HEAP_CHUNK_CELLS 65536
+
+struct heap_chunk {
+  scm_object *cells, *end;
+};
+
+static struct heap_chunk *chunks;
+static size_t chunk_count;
+
+static scm_object *free_list;
+static size_t heap_cells, free_cells;
+
+static scm_object ***roots;
+static size_t root_count, root_cap;
+
+static void (**tracers)(void);
+static size_t tracer_count;
+
+static scm_object **mark_stack;
+static size_t mark_top, mark_cap;
+
+static void *stack_bottom;
+
+static scm_object **symbols;
+static size_t symbol_count, symbol_cap;
+
+scm_object *quote_sym, *define_sym, *lambda_sym, *if_sym, *set_sym, *eof_sym, *quasiquote_sym, *unquote_sym;
+scm_object *begin_sym, *let_sym, *letrec_sym, *cond_sym, *case_sym, *else_sym, *arrow_sym;
+
+static void add_chunk(scm_object *cells, size_t n) {
+  /* keep the chunk array sorted by address for find_chunk */
+  struct heap_chunk *grown = realloc(chunks, (chunk_count + 1) * sizeof(*chunks));
+  if (!grown) {
+    err(1, "failed to allocate heap chunk table");
   }
-  o->tag = tag;
-  return o;
+  chunks = grown;
+  size_t i = chunk_count++;
+  while (i > 0 && chunks[i - 1].cells > cells) {
+    chunks[i] = chunks[i - 1];
+    i--;
+  }
+  chunks[i].cells = cells;
+  chunks[i].end = cells + n;
+  heap_cells += n;
 }
 
-scm_object *new_integer(int num) {
-  scm_object *o = new(SCHEME_INTEGER);
-  o->integer_value = num;
-  return o;
+static void heap_grow(void) {
+  scm_object *cells = malloc(HEAP_CHUNK_CELLS * sizeof(scm_object));
+  if (!cells) {
+    err(1, "failed to grow heap to %zu cells", heap_cells + HEAP_CHUNK_CELLS);
+  }
+  add_chunk(cells, HEAP_CHUNK_CELLS);
+
+  for (size_t j = HEAP_CHUNK_CELLS; j-- > 0;) {
+    cells[j].tag = SCHEME_FREE;
+    cells[j].mark = 0;
+    cells[j].fwd = free_list;
+    free_list = &cells[j];
+  }
+  free_cells += HEAP_CHUNK_CELLS;
+}
+
+/* takes n cells restored from an image into the heap, all of them in use */
+void heap_adopt(scm_object *cells, size_t n) {
+  add_chunk(cells, n);
 }
 
-scm_object *new_char(char c) {
-  scm_object *o = new(SCHEME_CHARACTER);
-  o->char_value = c;
+/* the cell containing address p, or NULL if p doesn't point into the heap */
+static scm_object *find_cell(uintptr_t p) {
+  size_t lo = 0, hi = chunk_count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (p < (uintptr_t) chunks[mid].cells) {
+      hi = mid;
+    } else if (p >= (uintptr_t) chunks[mid].end) {
+      lo = mid + 1;
+    } else {
+      scm_object *cell = chunks[mid].cells + (p - (uintptr_t) chunks[mid].cells) / sizeof(scm_object);
+      return cell->tag == SCHEME_FREE ? NULL : cell;
+    }
+  }
+  return NULL;
+}
+
+void gc_mark(scm_object *o) {
+  if (!o || IS_IMMEDIATE(o) || o->mark) {
+    return;
+  }
+  o->mark = 1;
+  if (mark_top == mark_cap) {
+    mark_cap = mark_cap ? mark_cap * 2 : 1024;
+    if (!(mark_stack = realloc(mark_stack, mark_cap * sizeof(*mark_stack)))) {
+      err(1, "failed to grow mark stack");
+    }
+  }
+  mark_stack[mark_top++] = o;
+}
+
+static void trace(void) {
+  while (mark_top > 0) {
+    scm_object *o = mark_stack[--mark_top];
+    switch (o->tag) {
+      case SCHEME_CONS:
+        gc_mark(o->car);
+        gc_mark(o->cdr);
+        break;
+      case SCHEME_CLOSURE:
+        gc_mark(o->env);
+        gc_mark(o->expr);
+        break;
+      case SCHEME_KNOT:
+        gc_mark(o->fwd);
+        break;
+      case SCHEME_SYMBOL:
+        gc_mark(o->sym_global);
+        break;
+      case SCHEME_FRAME:
+      case SCHEME_VECTOR:
+      case SCHEME_CONTINUATION:
+        for (size_t i = 0; i < o->nslots; i++) {
+          gc_mark(o->slots[i]);
+        }
+        break;
+      case SCHEME_HASHTABLE:
+        hashtab_mark(o);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+/* everything above this frame, so all of the caller's frame is included */
+static __attribute__((noinline)) void scan_stack(void) {
+  uintptr_t *p = __builtin_frame_address(0);
+  for (; (void *) p < stack_bottom; p++) {
+    gc_mark(find_cell(*p));
+  }
+}
+
+/*
+ * Spills every callee-saved register into this frame before scanning, so a
+ * pointer held only in a register is seen. setjmp isn't enough: glibc
+ * mangles the frame pointer it saves in the jmp_buf.
+ */
+static __attribute__((noinline)) void mark_stack_range(void) {
+  __builtin_unwind_init();
+  scan_stack();
+  /* keeps the call above from becoming a tail call that drops this frame */
+  __asm__ volatile ("" ::: "memory");
+}
+
+static void sweep(void) {
+  free_list = NULL;
+  free_cells = 0;
+  for (size_t i = 0; i < chunk_count; i++) {
+    for (scm_object *o = chunks[i].end; o-- > chunks[i].cells;) {
+      if (o->mark) {
+        o->mark = 0;
+        continue;
+      }
+      if (o->tag == SCHEME_STRING) {
+        free(o->buffer);
+      } else if (o->tag == SCHEME_BIGNUM) {
+        free(o->big_limbs);
+      } else if (o->tag == SCHEME_S32VECTOR || o->tag == SCHEME_S64VECTOR) {
+        free(o->vec_data);
+      } else if (o->tag == SCHEME_SYMBOL && !o->sym_interned) {
+        free(o->sym_value);
+      } else if (o->tag == SCHEME_FRAME || o->tag == SCHEME_VECTOR || o->tag == SCHEME_CONTINUATION) {
+        free(o->slots);
+      } else if (o->tag == SCHEME_HASHTABLE) {
+        hashtab_free(o);
+      } else if (o->tag == SCHEME_PORT) {
+        port_free(o);
+      }
+      o->tag = SCHEME_FREE;
+      o->fwd = free_list;
+      free_list = o;
+      free_cells++;
+    }
+  }
+}
+
+void gc_collect(void) {
+  stats.collections++;
+  for (size_t i = 0; i < root_count; i++) {
+    gc_mark(*roots[i]);
+  }
+  for (size_t i = 0; i < symbol_cap; i++) {
+    gc_mark(symbols[i]);
+  }
+  for (size_t i = 0; i < tracer_count; i++) {
+    tracers[i]();
+  }
+  mark_stack_range();
+  trace();
+  sweep();
+}
+
+void gc_init(void *bottom) {
+  stack_bottom = bottom;
+  heap_grow();
+}
+
+void gc_root(scm_object **root) {
+  if (root_count == root_cap) {
+    root_cap = root_cap ? root_cap * 2 : 32;
+    if (!(roots = realloc(roots, root_cap * sizeof(*roots)))) {
+      err(1, "failed to register gc root");
+    }
+  }
+  roots[root_count++] = root;
+}
+
+/* tracer is called during marking to gc_mark roots the collector can't see */
+void gc_tracer(void (*tracer)(void)) {
+  if (!(tracers = realloc(tracers, (tracer_count + 1) * sizeof(*tracers)))) {
+    err(1, "failed to register gc tracer");
+  }
+  tracers[tracer_count++] = tracer;
+}
+
+scm_object *new(enum obj_tag tag) {
+  if (!free_list) {
+    gc_collect();
+    /* keep at least half of the heap free so collections stay infrequent */
+    while (free_cells < heap_cells / 2) {
+      heap_grow();
+    }
+  }
+
+  scm_object *o = free_list;
+  free_list = o->fwd;
+  free_cells--;
+  stats.objects[tag]++;
+  stats.bytes[tag] += sizeof(scm_object);
+  o->tag = tag;
+  o->car = o->cdr = NULL;
   return o;
 }
 
 scm_object *new_string(char *buf, int size) {
   scm_object *o = new(SCHEME_STRING);
+  stats.bytes[SCHEME_STRING] += size;
   o->buffer = buf;
   o->length = size;
   return o;
@@ -35,22 +267,119 @@ scm_object *cons(scm_object *car, scm_object *cdr) {
   return o;
 }
 
-scm_object *make_symbol(char *sym) {
-  scm_object *elem = symbol_table;
+/*
+ * Interned symbols live in an open-addressing table keyed on their cached
+ * hash. Their names are carved out of an append-only string arena, since an
+ * interned symbol is never freed.
+ */
+
+#define SYMBOL_ARENA_SIZE 65536
+
+static char *arena, *arena_end;
+
+static uint32_t hash_name(const char *name, size_t len) {
+  uint32_t h = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ (unsigned char) name[i]) * 16777619u;
+  }
+  return h;
+}
+
+static char *arena_strndup(const char *name, size_t len) {
+  if ((size_t) (arena_end - arena) < len + 1) {
+    size_t size = len + 1 > SYMBOL_ARENA_SIZE ? len + 1 : SYMBOL_ARENA_SIZE;
+    if (!(arena = malloc(size))) {
+      err(1, "failed to allocate symbol arena");
+    }
+    arena_end = arena + size;
+  }
+  char *copy = arena;
+  memcpy(copy, name, len);
+  copy[len] = '\0';
+  arena += len + 1;
+  return copy;
+}
+
+static void symbols_grow(void) {
+  size_t cap = symbol_cap ? symbol_cap * 2 : 1024;
+  scm_object **table = calloc(cap, sizeof(*table));
+  if (!table) {
+    err(1, "failed to grow symbol table to %zu entries", cap);
+  }
+  for (size_t i = 0; i < symbol_cap; i++) {
+    if (symbols[i]) {
+      size_t j = symbols[i]->sym_hash & (cap - 1);
+      while (table[j]) {
+        j = (j + 1) & (cap - 1);
+      }
+      table[j] = symbols[i];
+    }
+  }
+  free(symbols);
+  symbols = table;
+  symbol_cap = cap;
+}
+
+scm_object *intern(const char *name, size_t len) {
+  if (2 * (symbol_count + 1) > symbol_cap) {
+    symbols_grow();
+  }
 
-  while (elem->tag != SCHEME_NIL) {
-    assert(elem->tag == SCHEME_CONS);
-    assert(CAR(elem)->tag == SCHEME_SYMBOL);
-    if (strcmp(CAR(elem)->sym_value, sym) == 0) {
-      return CAR(elem);
+  uint32_t hash = hash_name(name, len);
+  size_t i = hash & (symbol_cap - 1);
+  for (scm_object *sym; (sym = symbols[i]); i = (i + 1) & (symbol_cap - 1)) {
+    if (sym->sym_hash == hash && strncmp(sym->sym_value, name, len) == 0 && sym->sym_value[len] == '\0') {
+      return sym;
     }
-    elem = CDR(elem);
   }
 
   scm_object *obj = new(SCHEME_SYMBOL);
-  obj->sym_value = strdup(sym);
-  symbol_table = cons(obj, symbol_table);
+  obj->sym_value = arena_strndup(name, len);
+  obj->sym_hash = hash;
+  obj->sym_interned = 1;
+  obj->sym_global = SCM_UNBOUND;
+  symbols[i] = obj;
+  symbol_count++;
+
+  return obj;
+}
+
+void each_symbol(void (*fn)(scm_object *)) {
+  for (size_t i = 0; i < symbol_cap; i++) {
+    if (symbols[i]) {
+      fn(symbols[i]);
+    }
+  }
+}
+
+/* makes syms, which must be interned and distinct, the whole symbol table */
+void reset_symbols(scm_object **syms, size_t n) {
+  free(symbols);
+  symbols = NULL;
+  symbol_count = symbol_cap = 0;
+  while (2 * n > symbol_cap) {
+    symbols_grow();
+  }
+  for (size_t i = 0; i < n; i++) {
+    size_t j = syms[i]->sym_hash & (symbol_cap - 1);
+    while (symbols[j]) {
+      j = (j + 1) & (symbol_cap - 1);
+    }
+    symbols[j] = syms[i];
+  }
+  symbol_count = n;
+}
 
+scm_object *make_symbol(char *sym) {
+  return intern(sym, strlen(sym));
+}
+
+scm_object *new_symbol(char *sym) {
+  scm_object *obj = new(SCHEME_SYMBOL);
+  obj->sym_value = strdup(sym);
+  obj->sym_hash = hash_name(sym, strlen(sym));
+  obj->sym_interned = 0;
+  obj->sym_global = SCM_UNBOUND;
   return obj;
 }
 
@@ -61,4 +390,26 @@ scm_object *new_closure(scm_object *env, scm_object *expr) {
   return o;
 }
 
+static scm_object *new_slots(enum obj_tag tag, size_t nslots, scm_object *fill) {
+  scm_object **slots = malloc(nslots * sizeof(*slots));
+  if (!slots && nslots) {
+    err(1, "failed to allocate %s of %zu slots", tag_str(tag), nslots);
+  }
+  for (size_t i = 0; i < nslots; i++) {
+    slots[i] = fill;
+  }
 
+  scm_object *o = new(tag);
+  stats.bytes[tag] += nslots * sizeof(*slots);
+  o->slots = slots;
+  o->nslots = nslots;
+  return o;
+}
+
+scm_object *new_frame(size_t nslots) {
+  return new_slots(SCHEME_FRAME, nslots, SCM_UNBOUND);
+}
+
+scm_object *new_vector(size_t length, scm_object *fill) {
+  return new_slots(SCHEME_VECTOR, length, fill);
+}
@@ -0,0 +1,461 @@
+#include "analyze.h"
+#include "lib.h"
+
+/*
+ * The analyzer rewrites an expanded form so that every reference to a local
+ * variable becomes a (depth, slot) address. Depth 0 is the call frame of the
+ * innermost lambda, whose slot 0 holds the closure's captured frame; depth 1
+ * indexes into that captured frame. Closures are flat: they copy only the
+ * free variables they use. Variables that may be assigned after being
+ * captured are boxed in a knot when the capture happens.
+ *
+ * begin, let, letrec, cond and case are core forms rather than macros, so a
+ * body or a local binding doesn't cost a closure. Inside a lambda, let and
+ * letrec bind their variables in slots of the lambda's own frame; a let
+ * that has ended gives its slots to the next one. A binding always stores
+ * into the slot itself, never through a knot left there by an earlier
+ * binding, so every let makes fresh variables.
+ */
+
+struct scope {
+  struct scope *parent;
+  scm_object *vars;     /* (symbol . slot) for params and internal defines */
+  scm_object *mutable;  /* symbols assigned by set! or an internal define */
+  scm_object *captures; /* (symbol . (index . parent address)), newest first */
+  int nslots, ncaptures;
+  int max_slots; /* most slots in use at once, lets included */
+};
+
+static int is_member(scm_object *x, scm_object *list) {
+  for (; list != scm_nil; list = CDR(list)) {
+    if (CAR(list) == x) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static scm_object *assq(scm_object *x, scm_object *alist) {
+  for (; alist != scm_nil; alist = CDR(alist)) {
+    if (CAAR(alist) == x) {
+      return CAR(alist);
+    }
+  }
+  return NULL;
+}
+
+static scm_object *define_name(scm_object *form) {
+  scm_object *name = CADR(form);
+  if (TAG(name) == SCHEME_CONS) {
+    name = CAR(name);
+  }
+  if (TAG(name) != SCHEME_SYMBOL) {
+    errx(1, "can't define %s", tag_str(TAG(name)));
+  }
+  return name;
+}
+
+/* internal defines of a body, not counting those of nested lambdas and lets */
+static scm_object *collect_defines(scm_object *x, scm_object *acc) {
+  if (TAG(x) != SCHEME_CONS || CAR(x) == quote_sym || CAR(x) == lambda_sym ||
+      CAR(x) == let_sym || CAR(x) == letrec_sym) {
+    return acc;
+  }
+  if (CAR(x) == define_sym) {
+    acc = cons(define_name(x), acc);
+    x = CDR(x);
+  }
+  for (; TAG(x) == SCHEME_CONS; x = CDR(x)) {
+    acc = collect_defines(CAR(x), acc);
+  }
+  return acc;
+}
+
+/* every set! target in a body, including those of nested lambdas */
+static scm_object *collect_assigned(scm_object *x, scm_object *acc) {
+  if (TAG(x) != SCHEME_CONS || CAR(x) == quote_sym) {
+    return acc;
+  }
+  if (CAR(x) == set_sym && TAG(CDR(x)) == SCHEME_CONS) {
+    acc = cons(CADR(x), acc);
+  }
+  for (; TAG(x) == SCHEME_CONS; x = CDR(x)) {
+    acc = collect_assigned(CAR(x), acc);
+  }
+  return acc;
+}
+
+/* takes n more slots of the frame, returning the number of the first */
+static int reserve_slots(struct scope *s, int n) {
+  int first = s->nslots + 1;
+  s->nslots += n;
+  if (s->nslots > s->max_slots) {
+    s->max_slots = s->nslots;
+  }
+  return first;
+}
+
+static void add_var(struct scope *s, scm_object *name) {
+  if (TAG(name) != SCHEME_SYMBOL) {
+    errx(1, "parameter of lambda must be a symbol, got %s", tag_str(TAG(name)));
+  }
+  s->vars = cons(cons(name, new_integer(reserve_slots(s, 1))), s->vars);
+}
+
+/* the address of name as seen from s, or NULL if it's a global */
+static scm_object *lookup(struct scope *s, scm_object *name) {
+  if (!s) {
+    return NULL;
+  }
+
+  scm_object *entry;
+  if ((entry = assq(name, s->vars))) {
+    return MAKE_LOCAL(0, INT_VALUE(CDR(entry)), is_member(name, s->mutable));
+  }
+  if ((entry = assq(name, s->captures))) {
+    scm_object *addr = CDDR(entry);
+    return MAKE_LOCAL(1, INT_VALUE(CADR(entry)), LOCAL_BOX(addr));
+  }
+
+  scm_object *addr = lookup(s->parent, name);
+  if (!addr) {
+    return NULL;
+  }
+  int index = s->ncaptures++;
+  s->captures = cons(cons(name, cons(new_integer(index), addr)), s->captures);
+  return MAKE_LOCAL(1, index, LOCAL_BOX(addr));
+}
+
+static scm_object *analyze_expr(scm_object *, struct scope *);
+
+static scm_object *analyze_list(scm_object *x, struct scope *s) {
+  scm_object *head = scm_nil, **tail_ptr = &head;
+
+  for (; TAG(x) == SCHEME_CONS; x = CDR(x)) {
+    *tail_ptr = cons(analyze_expr(CAR(x), s), scm_nil);
+    tail_ptr = &CDR(*tail_ptr);
+  }
+  *tail_ptr = x;
+
+  return head;
+}
+
+static void check_body(scm_object *body, scm_object *form) {
+  if (TAG(body) != SCHEME_CONS) {
+    errx(1, "%s: empty body", form->sym_value);
+  }
+}
+
+static scm_object *analyze_lambda(scm_object *params, scm_object *body, struct scope *parent, scm_object *name) {
+  struct scope s = { parent, scm_nil, scm_nil, scm_nil, 0, 0, 0 };
+  int nreq = 0;
+
+  check_body(body, lambda_sym);
+  switch (TAG(params)) {
+    case SCHEME_CONS:
+    case SCHEME_NIL:
+    case SCHEME_SYMBOL:
+      break;
+    default:
+      errx(1, "parameter of lambda must be a list or symbol, got %s", tag_str(TAG(params)));
+  }
+
+  scm_object *p = params;
+  for (; TAG(p) == SCHEME_CONS; p = CDR(p), nreq++) {
+    add_var(&s, CAR(p));
+  }
+  if (p != scm_nil) {
+    add_var(&s, p);
+  }
+
+  for (scm_object *d = collect_defines(body, scm_nil); d != scm_nil; d = CDR(d)) {
+    if (!assq(CAR(d), s.vars)) {
+      add_var(&s, CAR(d));
+    }
+    s.mutable = cons(CAR(d), s.mutable);
+  }
+  for (scm_object *a = collect_assigned(body, scm_nil); a != scm_nil; a = CDR(a)) {
+    if (assq(CAR(a), s.vars)) {
+      s.mutable = cons(CAR(a), s.mutable);
+    }
+  }
+
+  body = analyze_list(body, &s);
+
+  scm_object *info = new_frame(LAMBDA_CAPTURES + s.ncaptures);
+  info->slots[LAMBDA_NREQ] = new_integer(nreq);
+  info->slots[LAMBDA_REST] = SCM_BOOL(p != scm_nil);
+  info->slots[LAMBDA_NSLOTS] = new_integer(s.max_slots + 1);
+  info->slots[LAMBDA_CODE] = scm_nil;
+  info->slots[LAMBDA_NAME] = name;
+  for (scm_object *c = s.captures; c != scm_nil; c = CDR(c)) {
+    info->slots[LAMBDA_CAPTURES + INT_VALUE(CADAR(c))] = CDDR(CAR(c));
+  }
+
+  return cons(lambda_sym, cons(info, body));
+}
+
+/* (define f (lambda ...)) and a lambda bound by let name the procedure too */
+static scm_object *analyze_init(scm_object *name, scm_object *init, struct scope *s) {
+  if (TAG(init) == SCHEME_CONS && CAR(init) == lambda_sym && TAG(CDR(init)) == SCHEME_CONS) {
+    return analyze_lambda(CADR(init), CDDR(init), s, name);
+  }
+  return analyze_expr(init, s);
+}
+
+/* splits ((var init) ...) into the lists of its variables and its inits */
+static void split_bindings(scm_object *form, scm_object *bindings, scm_object **vars, scm_object **inits) {
+  scm_object **var_tail = vars, **init_tail = inits;
+  *vars = *inits = scm_nil;
+
+  for (; TAG(bindings) == SCHEME_CONS; bindings = CDR(bindings)) {
+    scm_object *b = CAR(bindings);
+    if (TAG(b) != SCHEME_CONS || TAG(CAR(b)) != SCHEME_SYMBOL || TAG(CDR(b)) != SCHEME_CONS || CDDR(b) != scm_nil) {
+      errx(1, "%s: bad binding", form->sym_value);
+    }
+    *var_tail = cons(CAR(b), scm_nil);
+    var_tail = &CDR(*var_tail);
+    *init_tail = cons(CADR(b), scm_nil);
+    init_tail = &CDR(*init_tail);
+  }
+  if (bindings != scm_nil) {
+    errx(1, "%s: bad bindings", form->sym_value);
+  }
+}
+
+/* puts name in slot, in scope until s->vars is reset; returns its address */
+static scm_object *bind_var(struct scope *s, scm_object *name, int slot, int mutable) {
+  s->vars = cons(cons(name, new_integer(slot)), s->vars);
+  if (mutable && !is_member(name, s->mutable)) {
+    s->mutable = cons(name, s->mutable);
+  }
+  return lookup(s, name);
+}
+
+/*
+ * (let ((var init) ...) body) becomes (let ((addr . init) ...) . body),
+ * which evaluates the inits, stores each into its slot and runs the body.
+ * letrec binds its variables to the unbound marker first and assigns them
+ * with defines at the head of the body, like internal defines. At top
+ * level there's no frame, so both become lambdas applied on the spot.
+ */
+static scm_object *analyze_let(scm_object *x, struct scope *s) {
+  scm_object *form = CAR(x), *vars, *inits;
+
+  if (TAG(CDR(x)) != SCHEME_CONS) {
+    errx(1, "%s: bad syntax", form->sym_value);
+  }
+  if (form == let_sym && TAG(CADR(x)) == SCHEME_SYMBOL) {
+    /* (let name ((var init) ...) body) is ((letrec ((name (lambda (var ...) body))) name) init ...) */
+    scm_object *name = CADR(x);
+    if (TAG(CDDR(x)) != SCHEME_CONS) {
+      errx(1, "let: bad syntax");
+    }
+    split_bindings(form, CADDR(x), &vars, &inits);
+    scm_object *proc = cons(lambda_sym, cons(vars, CDDDR(x)));
+    scm_object *bindings = cons(cons(name, cons(proc, scm_nil)), scm_nil);
+    return analyze_expr(cons(cons(letrec_sym, cons(bindings, cons(name, scm_nil))), inits), s);
+  }
+
+  scm_object *body = CDDR(x);
+  split_bindings(form, CADR(x), &vars, &inits);
+  check_body(body, form);
+
+  if (!s) {
+    if (form == let_sym) {
+      return analyze_expr(cons(cons(lambda_sym, cons(vars, body)), inits), s);
+    }
+    scm_object *defines = scm_nil, **tail = &defines;
+    for (; vars != scm_nil; vars = CDR(vars), inits = CDR(inits)) {
+      *tail = cons(cons(define_sym, cons(CAR(vars), cons(CAR(inits), scm_nil))), scm_nil);
+      tail = &CDR(*tail);
+    }
+    *tail = body;
+    return analyze_expr(cons(cons(lambda_sym, cons(scm_nil, defines)), scm_nil), s);
+  }
+
+  scm_object *saved_vars = s->vars, *assigned = collect_assigned(body, scm_nil);
+  scm_object *bindings = scm_nil, **tail = &bindings, *defines = scm_nil, **def_tail = &defines;
+  int saved_slots = s->nslots, slot = reserve_slots(s, scm_len(vars));
+
+  if (form == let_sym) {
+    /* the slots are taken first, so lets in the inits can't reuse them */
+    for (scm_object *v = vars, *i = inits; v != scm_nil; v = CDR(v), i = CDR(i)) {
+      CAR(i) = analyze_init(CAR(v), CAR(i), s);
+    }
+    for (; vars != scm_nil; vars = CDR(vars), inits = CDR(inits)) {
+      *tail = cons(cons(bind_var(s, CAR(vars), slot++, is_member(CAR(vars), assigned)), CAR(inits)), scm_nil);
+      tail = &CDR(*tail);
+    }
+  } else {
+    for (scm_object *v = vars; v != scm_nil; v = CDR(v)) {
+      *tail = cons(cons(bind_var(s, CAR(v), slot++, 1), SCM_UNBOUND), scm_nil);
+      tail = &CDR(*tail);
+    }
+    for (; vars != scm_nil; vars = CDR(vars), inits = CDR(inits)) {
+      scm_object *init = analyze_init(CAR(vars), CAR(inits), s);
+      *def_tail = cons(cons(define_sym, cons(lookup(s, CAR(vars)), cons(init, scm_nil))), scm_nil);
+      def_tail = &CDR(*def_tail);
+    }
+  }
+  /* defines in the body are local to it */
+  for (scm_object *d = collect_defines(body, scm_nil); d != scm_nil; d = CDR(d)) {
+    *tail = cons(cons(bind_var(s, CAR(d), reserve_slots(s, 1), 1), SCM_UNBOUND), scm_nil);
+    tail = &CDR(*tail);
+  }
+
+  *def_tail = analyze_list(body, s);
+  s->vars = saved_vars;
+  s->nslots = saved_slots;
+  return cons(let_sym, cons(bindings, defines));
+}
+
+/* a body in place of one expression */
+static scm_object *analyze_body(scm_object *body, struct scope *s) {
+  body = analyze_list(body, s);
+  return CDR(body) == scm_nil ? CAR(body) : cons(begin_sym, body);
+}
+
+/*
+ * cond becomes nested ifs, with #f when no clause is taken. A (test => proc)
+ * clause binds the test's value to an uninterned variable, which nothing
+ * in the clauses can name, and calls proc on it.
+ */
+static scm_object *analyze_cond(scm_object *clauses, struct scope *s) {
+  if (clauses == scm_nil) {
+    return scm_f;
+  }
+  if (TAG(clauses) != SCHEME_CONS || TAG(CAR(clauses)) != SCHEME_CONS || TAG(CDAR(clauses)) != SCHEME_CONS) {
+    errx(1, "cond: bad clause");
+  }
+  scm_object *test = CAAR(clauses), *body = CDAR(clauses);
+  if (test == else_sym) {
+    return analyze_body(body, s);
+  }
+  if (CAR(body) == arrow_sym) {
+    if (TAG(CDR(body)) != SCHEME_CONS || CDDR(body) != scm_nil) {
+      errx(1, "cond: bad => clause");
+    }
+    scm_object *var = new_symbol("=>"), *call = cons(CADR(body), cons(var, scm_nil));
+    scm_object *branch = cons(if_sym, cons(var, cons(call, cons(cons(cond_sym, CDR(clauses)), scm_nil))));
+    return analyze_let(cons(let_sym, cons(cons(cons(var, cons(test, scm_nil)), scm_nil), cons(branch, scm_nil))), s);
+  }
+  test = analyze_expr(test, s);
+  body = analyze_body(body, s);
+  return cons(if_sym, cons(test, cons(body, cons(analyze_cond(CDR(clauses), s), scm_nil))));
+}
+
+/* (case key ((datum ...) . body) ...), with #t for the data of an else clause */
+static scm_object *analyze_case(scm_object *x, struct scope *s) {
+  if (TAG(CDR(x)) != SCHEME_CONS) {
+    errx(1, "case: bad syntax");
+  }
+  scm_object *clauses = scm_nil, **tail = &clauses, *c = CDDR(x);
+  scm_object *key = analyze_expr(CADR(x), s);
+
+  for (; TAG(c) == SCHEME_CONS; c = CDR(c)) {
+    scm_object *clause = CAR(c), *data;
+    if (TAG(clause) != SCHEME_CONS || TAG(CDR(clause)) != SCHEME_CONS) {
+      errx(1, "case: bad clause");
+    }
+    if (CAR(clause) == else_sym) {
+      data = scm_t;
+    } else if (TAG(CAR(clause)) == SCHEME_CONS || CAR(clause) == scm_nil) {
+      data = CAR(clause);
+    } else {
+      data = cons(CAR(clause), scm_nil);
+    }
+    *tail = cons(cons(data, analyze_list(CDR(clause), s)), scm_nil);
+    tail = &CDR(*tail);
+  }
+  return cons(case_sym, cons(key, clauses));
+}
+
+int case_matches(scm_object *key, scm_object *data) {
+  if (data == scm_t) {
+    return 1;
+  }
+  for (; data != scm_nil; data = CDR(data)) {
+    if (scm_eqv(key, CAR(data))) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* the forms that used to be macros, which local variables may shadow */
+static int is_core_form(scm_object *head) {
+  return head == begin_sym || head == let_sym || head == letrec_sym || head == cond_sym || head == case_sym;
+}
+
+static scm_object *analyze_expr(scm_object *x, struct scope *s) {
+  scm_object *addr;
+
+  switch (TAG(x)) {
+    case SCHEME_SYMBOL:
+      return (addr = lookup(s, x)) ? addr : x;
+    case SCHEME_CONS:
+      break;
+    default:
+      return x;
+  }
+
+  if (CAR(x) == quote_sym) {
+    return x;
+  } else if (CAR(x) == lambda_sym) {
+    return analyze_lambda(CADR(x), CDDR(x), s, scm_f);
+  } else if (CAR(x) == define_sym || CAR(x) == set_sym) {
+    scm_object *name = CADR(x), *expr;
+    if (CAR(x) == define_sym && TAG(name) == SCHEME_CONS) {
+      expr = analyze_lambda(CDR(name), CDDR(x), s, CAR(name));
+      name = CAR(name);
+    } else if (CAR(x) == define_sym) {
+      expr = analyze_init(name, CADDR(x), s);
+    } else {
+      expr = analyze_expr(CADDR(x), s);
+    }
+    if (TAG(name) != SCHEME_SYMBOL) {
+      errx(1, "can't %s %s", CAR(x)->sym_value, tag_str(TAG(name)));
+    }
+    addr = lookup(s, name);
+    return cons(CAR(x), cons(addr ? addr : name, cons(expr, scm_nil)));
+  } else if (is_core_form(CAR(x)) && lookup(s, CAR(x))) {
+    /* a local variable of the same name shadows the form, as it does a macro */
+    return analyze_list(x, s);
+  } else if (CAR(x) == begin_sym) {
+    return CDR(x) == scm_nil ? scm_nil : cons(begin_sym, analyze_list(CDR(x), s));
+  } else if (CAR(x) == let_sym || CAR(x) == letrec_sym) {
+    return analyze_let(x, s);
+  } else if (CAR(x) == cond_sym) {
+    return analyze_cond(CDR(x), s);
+  } else if (CAR(x) == case_sym) {
+    return analyze_case(x, s);
+  }
+
+  return analyze_list(x, s);
+}
+
+scm_object *analyze(scm_object *x) {
+  return analyze_expr(x, NULL);
+}
+
+/* close an analyzed lambda over the variables it captures from a frame */
+scm_object *make_closure(scm_object *lambda, scm_object **slots) {
+  scm_object *info = CADR(lambda), *captured = scm_nil;
+  size_t ncaptures = info->nslots - LAMBDA_CAPTURES;
+
+  if (ncaptures) {
+    captured = new_frame(ncaptures);
+    for (size_t i = 0; i < ncaptures; i++) {
+      scm_object *addr = info->slots[LAMBDA_CAPTURES + i], **slot = local_slot(slots, addr);
+      if (LOCAL_BOX(addr) && !is_knot(*slot)) {
+        scm_object *box = new(SCHEME_KNOT);
+        box->fwd = *slot;
+        *slot = box;
+      }
+      captured->slots[i] = *slot;
+    }
+  }
+
+  return new_closure(captured, lambda);
+}
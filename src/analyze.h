@@ -0,0 +1,34 @@
+#ifndef ANALYZE_H_
+#define ANALYZE_H_
+
+#include "scheme.h"
+
+/*
+ * An analyzed lambda is (lambda INFO . body), where INFO is a frame whose
+ * slots describe how to build the closure and its call frames.
+ */
+#define LAMBDA_NREQ     0 /* number of required parameters */
+#define LAMBDA_REST     1 /* #t if the last parameter collects the rest */
+#define LAMBDA_NSLOTS   2 /* size of a call frame */
+#define LAMBDA_CODE     3 /* compiled body, or () until the vm first calls it */
+#define LAMBDA_NAME     4 /* symbol the lambda was defined as, or #f */
+#define LAMBDA_CAPTURES 5 /* addresses of the captured variables, in order */
+
+/* slots is the slot array of a call frame, wherever the engine keeps it */
+static inline scm_object **local_slot(scm_object **slots, scm_object *addr) {
+  if (LOCAL_DEPTH(addr)) {
+    slots = slots[0]->slots;
+  }
+  return &slots[LOCAL_SLOT(addr)];
+}
+
+static inline int is_knot(scm_object *o) {
+  return !IS_IMMEDIATE(o) && o->tag == SCHEME_KNOT;
+}
+
+scm_object *analyze(scm_object *);
+scm_object *make_closure(scm_object *lambda, scm_object **slots);
+/* whether an analyzed case clause with these data takes key */
+int case_matches(scm_object *key, scm_object *data);
+
+#endif /* ANALYZE_H_ */
@@ -0,0 +1,205 @@
+#include "expand.h"
+
+/*
+ * Macro expander. Macros are ordinary procedures taking the cdr of the form
+ * and returning its replacement; they're kept in a hash table keyed by the
+ * macro's symbol. Lambda parameters and let variables shadow macros of the
+ * same name within their scope. The bindings of a let and the data of case
+ * clauses aren't forms, so they're left alone.
+ */
+
+struct macro {
+  scm_object *name, *expander;
+};
+
+static struct macro *macros;
+static size_t macros_cap, macros_count;
+
+static void macros_trace(void) {
+  for (size_t i = 0; i < macros_cap; i++) {
+    if (macros[i].name) {
+      gc_mark(macros[i].name);
+      gc_mark(macros[i].expander);
+    }
+  }
+}
+
+static struct macro *macro_entry(scm_object *name) {
+  size_t i = name->sym_hash & (macros_cap - 1);
+  while (macros[i].name && macros[i].name != name) {
+    i = (i + 1) & (macros_cap - 1);
+  }
+  return &macros[i];
+}
+
+static void macros_grow(void) {
+  struct macro *old = macros;
+  size_t old_cap = macros_cap;
+
+  macros_cap = old_cap ? old_cap * 2 : 64;
+  if (!(macros = calloc(macros_cap, sizeof(*macros)))) {
+    err(1, "failed to allocate macro table");
+  }
+  for (size_t i = 0; i < old_cap; i++) {
+    if (old[i].name) {
+      *macro_entry(old[i].name) = old[i];
+    }
+  }
+  free(old);
+}
+
+void each_macro(void (*fn)(scm_object *name, scm_object *expander)) {
+  for (size_t i = 0; i < macros_cap; i++) {
+    if (macros[i].name) {
+      fn(macros[i].name, macros[i].expander);
+    }
+  }
+}
+
+void clear_macros(void) {
+  if (macros) {
+    memset(macros, 0, macros_cap * sizeof(*macros));
+  }
+  macros_count = 0;
+}
+
+void define_macro(scm_object *name, scm_object *expander) {
+  if (TAG(name) != SCHEME_SYMBOL) {
+    errx(1, "macro name must be a symbol, got %s", tag_str(TAG(name)));
+  }
+  if (!macros) {
+    gc_tracer(macros_trace);
+  }
+  if (2 * (macros_count + 1) > macros_cap) {
+    macros_grow();
+  }
+
+  struct macro *m = macro_entry(name);
+  if (!m->name) {
+    m->name = name;
+    macros_count++;
+  }
+  m->expander = expander;
+}
+
+scm_object *lookup_macro(scm_object *name) {
+  if (!macros_count) {
+    return NULL;
+  }
+  return macro_entry(name)->expander;
+}
+
+static int is_shadowed(scm_object *name, scm_object *shadow) {
+  for (; shadow != scm_nil; shadow = CDR(shadow)) {
+    if (CAR(shadow) == name) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+static scm_object *expand_expr(scm_object *, scm_object *);
+
+static scm_object *expand_list(scm_object *x, scm_object *shadow) {
+  scm_object *head = scm_nil, **tail_ptr = &head;
+
+  for (; TAG(x) == SCHEME_CONS; x = CDR(x)) {
+    *tail_ptr = cons(expand_expr(CAR(x), shadow), scm_nil);
+    tail_ptr = &CDR(*tail_ptr);
+  }
+  *tail_ptr = x;
+
+  return head;
+}
+
+/* (let [name] ((var init) ...) . body) or (letrec ((var init) ...) . body) */
+static scm_object *expand_let(scm_object *x, scm_object *shadow) {
+  scm_object *form = CAR(x), *name = scm_f, *rest = CDR(x), *inner = shadow, *b;
+
+  if (form == let_sym && TAG(CAR(rest)) == SCHEME_SYMBOL) {
+    name = CAR(rest);
+    rest = CDR(rest);
+    inner = cons(name, inner);
+  }
+  if (TAG(rest) != SCHEME_CONS) {
+    return x;
+  }
+  for (b = CAR(rest); TAG(b) == SCHEME_CONS; b = CDR(b)) {
+    if (TAG(CAR(b)) == SCHEME_CONS) {
+      inner = cons(CAAR(b), inner);
+    }
+  }
+
+  scm_object *bindings = scm_nil, **tail_ptr = &bindings;
+  for (b = CAR(rest); TAG(b) == SCHEME_CONS; b = CDR(b)) {
+    scm_object *binding = CAR(b);
+    if (TAG(binding) == SCHEME_CONS && TAG(CDR(binding)) == SCHEME_CONS) {
+      scm_object *init = expand_expr(CADR(binding), form == letrec_sym ? inner : shadow);
+      binding = cons(CAR(binding), cons(init, CDDR(binding)));
+    }
+    *tail_ptr = cons(binding, scm_nil);
+    tail_ptr = &CDR(*tail_ptr);
+  }
+  *tail_ptr = b;
+
+  rest = cons(bindings, expand_list(CDR(rest), inner));
+  return cons(form, name == scm_f ? rest : cons(name, rest));
+}
+
+/* (case key (data . body) ...) */
+static scm_object *expand_case(scm_object *x, scm_object *shadow) {
+  scm_object *clauses = scm_nil, **tail_ptr = &clauses, *c = CDDR(x);
+
+  for (; TAG(c) == SCHEME_CONS; c = CDR(c)) {
+    scm_object *clause = CAR(c);
+    if (TAG(clause) == SCHEME_CONS) {
+      clause = cons(CAR(clause), expand_list(CDR(clause), shadow));
+    }
+    *tail_ptr = cons(clause, scm_nil);
+    tail_ptr = &CDR(*tail_ptr);
+  }
+  *tail_ptr = c;
+
+  return cons(case_sym, cons(expand_expr(CADR(x), shadow), clauses));
+}
+
+static scm_object *expand_expr(scm_object *x, scm_object *shadow) {
+  scm_object *expander;
+
+  while (TAG(x) == SCHEME_CONS && TAG(CAR(x)) == SCHEME_SYMBOL && !is_shadowed(CAR(x), shadow)) {
+    if (CAR(x) == quote_sym) {
+      return x;
+    } else if (CAR(x) == lambda_sym && TAG(CDR(x)) == SCHEME_CONS) {
+      scm_object *params = CADR(x), *p = params;
+      for (; TAG(p) == SCHEME_CONS; p = CDR(p)) {
+        shadow = cons(CAR(p), shadow);
+      }
+      if (p != scm_nil) {
+        shadow = cons(p, shadow);
+      }
+      return cons(lambda_sym, cons(params, expand_list(CDDR(x), shadow)));
+    } else if ((CAR(x) == let_sym || CAR(x) == letrec_sym) && TAG(CDR(x)) == SCHEME_CONS) {
+      return expand_let(x, shadow);
+    } else if (CAR(x) == case_sym && TAG(CDR(x)) == SCHEME_CONS) {
+      return expand_case(x, shadow);
+    } else if (CAR(x) == cond_sym) {
+      scm_object *clauses = scm_nil, **tail_ptr = &clauses, *c = CDR(x);
+      for (; TAG(c) == SCHEME_CONS; c = CDR(c)) {
+        *tail_ptr = cons(TAG(CAR(c)) == SCHEME_CONS ? expand_list(CAR(c), shadow) : CAR(c), scm_nil);
+        tail_ptr = &CDR(*tail_ptr);
+      }
+      *tail_ptr = c;
+      return cons(cond_sym, clauses);
+    } else if ((expander = lookup_macro(CAR(x)))) {
+      x = scm_apply(expander, 1, &CDR(x));
+    } else {
+      break;
+    }
+  }
+
+  return TAG(x) == SCHEME_CONS ? expand_list(x, shadow) : x;
+}
+
+scm_object *expand(scm_object *x) {
+  return expand_expr(x, scm_nil);
+}
@@ -0,0 +1,12 @@
+#ifndef EXPAND_H_
+#define EXPAND_H_
+
+#include "scheme.h"
+
+void define_macro(scm_object *name, scm_object *expander);
+scm_object *lookup_macro(scm_object *name);
+scm_object *expand(scm_object *);
+void each_macro(void (*fn)(scm_object *name, scm_object *expander));
+void clear_macros(void);
+
+#endif /* EXPAND_H_ */
@@ -0,0 +1,597 @@
+#include "fasl.h"
+#include "hashtab.h"
+#include "number.h"
+#include "stats.h"
+
+/*
+ * FASL, a compact binary form for data. A datum starts with the magic
+ * "FASL" and a version byte, followed by its objects in preorder: an op
+ * byte, the op's operands, then the children. Counts, lengths and fixnums
+ * are LEB128 varints, fixnums zigzag encoded first; fixed-width numbers are
+ * little-endian.
+ *
+ * Like write-shared, the writer first walks the datum to find the objects
+ * reachable more than once, using the cells' mark bytes since nothing is
+ * allocated meanwhile. Those are written after an F_LABEL, numbered in
+ * order, and every later occurrence is an F_REF to that number, so shared
+ * structure stays shared and cycles end. The reader allocates a container
+ * and stores it before reading its children, so a reference back to it
+ * works while it's still being filled. Neither side recurses: the writer
+ * keeps a stack of objects still to write, the reader a stack of slots
+ * still to fill.
+ */
+
+#define FASL_MAGIC "FASL"
+#define FASL_VERSION 1
+
+enum fasl_op {
+  F_FIXNUM = 1,
+  F_CHAR = 2,
+  F_TRUE = 3,
+  F_FALSE = 4,
+  F_NIL = 5,
+  F_REF = 6, /* label number */
+  F_BIGNUM = 7, /* sign byte, limb count, limbs */
+  F_STRING = 8, /* length, bytes */
+  F_SYMBOL = 9, /* interned, length, name */
+  F_GENSYM = 10, /* uninterned, length, name */
+  F_CONS = 11, /* car, cdr */
+  F_VECTOR = 12, /* length, elements */
+  F_S32VECTOR = 13, /* length, elements */
+  F_S64VECTOR = 14, /* length, elements */
+  F_HASHTABLE = 15, /* kind byte, entry count, key and value of each */
+  F_LABEL = 16 /* numbers the object that follows */
+};
+
+/* mark bytes while writing, cleared again by the time the writer is done */
+enum { UNSEEN, ONCE, SHARED, LABELED };
+
+/* writing */
+
+static struct {
+  char *buf;
+  size_t len, cap;
+  scm_object **stack; /* objects still to write */
+  size_t depth, stack_cap;
+  scm_object **keys; /* label numbers by address, open addressing */
+  size_t *index, map_cap, count;
+} w;
+
+static void room(size_t n) {
+  if (w.len + n > w.cap) {
+    while (w.len + n > w.cap) {
+      w.cap = w.cap ? w.cap * 2 : 256;
+    }
+    if (!(w.buf = realloc(w.buf, w.cap))) {
+      err(1, "failed to grow fasl buffer");
+    }
+  }
+}
+
+static void put_byte(int b) {
+  room(1);
+  w.buf[w.len++] = (char) b;
+}
+
+static void put_bytes(const void *p, size_t len) {
+  room(len);
+  memcpy(w.buf + w.len, p, len);
+  w.len += len;
+}
+
+static void put_varint(uint64_t x) {
+  room(10);
+  for (; x >= 0x80; x >>= 7) {
+    w.buf[w.len++] = (char) (x | 0x80);
+  }
+  w.buf[w.len++] = (char) x;
+}
+
+static void put_le(uint64_t x, int width) {
+  room(width);
+  for (int i = 0; i < width; i++) {
+    w.buf[w.len++] = (char) (x >> 8 * i);
+  }
+}
+
+static void push(scm_object *o) {
+  if (w.depth == w.stack_cap) {
+    w.stack_cap = w.stack_cap ? w.stack_cap * 2 : 256;
+    if (!(w.stack = realloc(w.stack, w.stack_cap * sizeof(*w.stack)))) {
+      err(1, "failed to grow fasl stack");
+    }
+  }
+  w.stack[w.depth++] = o;
+}
+
+static size_t map_slot(scm_object *o) {
+  size_t mask = w.map_cap - 1, i = ((uintptr_t) o * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+  while (w.keys[i] && w.keys[i] != o) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static void map_grow(void) {
+  scm_object **keys = w.keys;
+  size_t *index = w.index, cap = w.map_cap;
+  w.map_cap = cap ? cap * 2 : 256;
+  w.keys = calloc(w.map_cap, sizeof(*w.keys));
+  w.index = malloc(w.map_cap * sizeof(*w.index));
+  if (!w.keys || !w.index) {
+    err(1, "failed to grow fasl object map");
+  }
+  for (size_t i = 0; i < cap; i++) {
+    if (keys[i]) {
+      size_t j = map_slot(keys[i]);
+      w.keys[j] = keys[i];
+      w.index[j] = index[i];
+    }
+  }
+  free(keys);
+  free(index);
+}
+
+static void count_entry(UNUSED scm_object *key, UNUSED scm_object *value, void *data) {
+  (*(size_t *) data)++;
+}
+
+/* popped key first, then its value */
+static void push_entry(scm_object *key, scm_object *value, UNUSED void *data) {
+  push(value);
+  push(key);
+}
+
+static void find_shared(scm_object *root) {
+  push(root);
+  while (w.depth > 0) {
+    scm_object *o = w.stack[--w.depth];
+    if (IS_IMMEDIATE(o)) {
+      continue;
+    }
+    if (o->mark != UNSEEN) {
+      o->mark = SHARED;
+      continue;
+    }
+    o->mark = ONCE;
+    switch (o->tag) {
+      case SCHEME_CONS:
+        push(CDR(o));
+        push(CAR(o));
+        break;
+      case SCHEME_VECTOR:
+        for (size_t i = 0; i < o->nslots; i++) {
+          push(o->slots[i]);
+        }
+        break;
+      case SCHEME_HASHTABLE:
+        hashtab_each(o, push_entry, NULL);
+        break;
+      default:
+        break;
+    }
+  }
+}
+
+static void write_object(scm_object *o) {
+  if (IS_INTEGER(o)) {
+    intptr_t x = INT_VALUE(o);
+    put_byte(F_FIXNUM);
+    put_varint(((uint64_t) x << 1) ^ (uint64_t) (x >> 63));
+    return;
+  }
+  if (IS_CHAR(o)) {
+    put_byte(F_CHAR);
+    put_byte(CHAR_VALUE(o));
+    return;
+  }
+  if (o == scm_t || o == scm_f || o == scm_nil) {
+    put_byte(o == scm_t ? F_TRUE : o == scm_f ? F_FALSE : F_NIL);
+    return;
+  }
+
+  switch (TAG(o)) {
+    case SCHEME_BIGNUM:
+    case SCHEME_STRING:
+    case SCHEME_SYMBOL:
+    case SCHEME_CONS:
+    case SCHEME_VECTOR:
+    case SCHEME_S32VECTOR:
+    case SCHEME_S64VECTOR:
+    case SCHEME_HASHTABLE:
+      break;
+    default:
+      errx(1, "fasl-write: can't write %s", tag_str(TAG(o)));
+  }
+  if (o->mark == LABELED) {
+    put_byte(F_REF);
+    put_varint(w.index[map_slot(o)]);
+    return;
+  }
+  if (o->mark == SHARED) {
+    if (2 * (w.count + 1) > w.map_cap) {
+      map_grow();
+    }
+    size_t i = map_slot(o);
+    w.keys[i] = o;
+    w.index[i] = w.count++;
+    o->mark = LABELED;
+    put_byte(F_LABEL);
+  } else {
+    o->mark = UNSEEN;
+  }
+
+  switch (o->tag) {
+    case SCHEME_BIGNUM:
+      put_byte(F_BIGNUM);
+      put_byte(o->big_sign < 0);
+      put_varint(o->big_len);
+      for (size_t i = 0; i < o->big_len; i++) {
+        put_le(o->big_limbs[i], 4);
+      }
+      break;
+    case SCHEME_STRING:
+      put_byte(F_STRING);
+      put_varint(o->length);
+      put_bytes(o->buffer, o->length);
+      break;
+    case SCHEME_SYMBOL: {
+      size_t len = strlen(o->sym_value);
+      put_byte(o->sym_interned ? F_SYMBOL : F_GENSYM);
+      put_varint(len);
+      put_bytes(o->sym_value, len);
+      break;
+    }
+    case SCHEME_CONS:
+      put_byte(F_CONS);
+      push(CDR(o));
+      push(CAR(o));
+      break;
+    case SCHEME_VECTOR:
+      put_byte(F_VECTOR);
+      put_varint(o->nslots);
+      for (size_t i = o->nslots; i-- > 0;) {
+        push(o->slots[i]);
+      }
+      break;
+    case SCHEME_S32VECTOR:
+      put_byte(F_S32VECTOR);
+      put_varint(o->vec_len);
+      for (size_t i = 0; i < o->vec_len; i++) {
+        put_le((uint32_t) ((int32_t *) o->vec_data)[i], 4);
+      }
+      break;
+    case SCHEME_S64VECTOR:
+      put_byte(F_S64VECTOR);
+      put_varint(o->vec_len);
+      for (size_t i = 0; i < o->vec_len; i++) {
+        put_le((uint64_t) ((int64_t *) o->vec_data)[i], 8);
+      }
+      break;
+    case SCHEME_HASHTABLE: {
+      size_t n = 0;
+      hashtab_each(o, count_entry, &n);
+      put_byte(F_HASHTABLE);
+      put_byte(hashtab_kind(o));
+      put_varint(n);
+      hashtab_each(o, push_entry, NULL);
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+char *fasl_encode(scm_object *obj, size_t *len) {
+  put_bytes(FASL_MAGIC, 4);
+  put_byte(FASL_VERSION);
+  find_shared(obj);
+  push(obj);
+  while (w.depth > 0) {
+    write_object(w.stack[--w.depth]);
+  }
+  for (size_t i = 0; i < w.map_cap; i++) {
+    if (w.keys[i]) {
+      w.keys[i]->mark = UNSEEN;
+    }
+  }
+
+  char *buf = w.buf;
+  *len = w.len;
+  free(w.stack);
+  free(w.keys);
+  free(w.index);
+  memset(&w, 0, sizeof(w));
+  return buf;
+}
+
+/* reading */
+
+static struct {
+  struct text_source *src;
+  scm_object *root; /* everything read so far hangs off it */
+  scm_object **objs; /* by label number */
+  size_t count, cap;
+  scm_object ***holes; /* slots still to fill */
+  size_t nholes, holes_cap;
+  scm_object **tables; /* hash tables and a vector of their entries, filled in at the end */
+  size_t ntables, tables_cap;
+  char *scratch; /* for bytes split across a refill */
+  size_t scratch_cap;
+} r;
+
+static void fasl_trace(void) {
+  gc_mark(r.root);
+  for (size_t i = 0; i < r.count; i++) {
+    gc_mark(r.objs[i]);
+  }
+  for (size_t i = 0; i < r.ntables; i++) {
+    gc_mark(r.tables[i]);
+  }
+}
+
+static void *grow(void *p, size_t *cap, size_t size) {
+  *cap = *cap ? *cap * 2 : 256;
+  if (!(p = realloc(p, *cap * size))) {
+    err(1, "failed to grow fasl reader");
+  }
+  return p;
+}
+
+/* fills slot straight away, so o is reachable before anything else is allocated */
+static scm_object *made(scm_object **slot, scm_object *o, int label) {
+  if (label) {
+    if (r.count == r.cap) {
+      r.objs = grow(r.objs, &r.cap, sizeof(*r.objs));
+    }
+    r.objs[r.count++] = o;
+  }
+  return *slot = o;
+}
+
+static void hole(scm_object **slot) {
+  if (r.nholes == r.holes_cap) {
+    r.holes = grow(r.holes, &r.holes_cap, sizeof(*r.holes));
+  }
+  r.holes[r.nholes++] = slot;
+}
+
+static int more(void) {
+  return r.src->pos < r.src->end || (r.src->refill && r.src->refill(r.src));
+}
+
+static unsigned char get_byte(void) {
+  if (!more()) {
+    errx(1, "fasl-read: unexpected end of data");
+  }
+  return (unsigned char) *r.src->pos++;
+}
+
+/* n contiguous bytes, valid until the next call */
+static const char *get_bytes(size_t n) {
+  const char *p = r.src->pos;
+  if ((size_t) (r.src->end - p) >= n) {
+    r.src->pos += n;
+    return p;
+  }
+  if (n > r.scratch_cap) {
+    free(r.scratch);
+    if (!(r.scratch = malloc(r.scratch_cap = n))) {
+      err(1, "failed to allocate %zu bytes of fasl data", n);
+    }
+  }
+  for (size_t got = 0; got < n;) {
+    if (!more()) {
+      errx(1, "fasl-read: unexpected end of data");
+    }
+    size_t k = (size_t) (r.src->end - r.src->pos) < n - got ? (size_t) (r.src->end - r.src->pos) : n - got;
+    memcpy(r.scratch + got, r.src->pos, k);
+    r.src->pos += k;
+    got += k;
+  }
+  return r.scratch;
+}
+
+static uint64_t get_varint(void) {
+  uint64_t x = 0;
+  for (int shift = 0; shift < 64; shift += 7) {
+    unsigned char b = get_byte();
+    x |= (uint64_t) (b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      return x;
+    }
+  }
+  errx(1, "fasl-read: bad varint");
+}
+
+static uint64_t le(const char *p, int width) {
+  uint64_t x = 0;
+  for (int i = 0; i < width; i++) {
+    x |= (uint64_t) (unsigned char) p[i] << 8 * i;
+  }
+  return x;
+}
+
+static char *get_string(size_t n) {
+  char *s = malloc(n + 1);
+  if (!s) {
+    err(1, "failed to allocate fasl string of %zu bytes", n);
+  }
+  memcpy(s, get_bytes(n), n);
+  s[n] = '\0';
+  return s;
+}
+
+static scm_object *read_numvec(scm_object **slot, int label, enum obj_tag type, int width) {
+  size_t n = get_varint();
+  void *data = calloc(n ? n : 1, width);
+  if (!data) {
+    err(1, "failed to allocate fasl vector of %zu elements", n);
+  }
+  for (size_t i = 0; i < n; i++) {
+    uint64_t x = le(get_bytes(width), width);
+    if (width == 4) {
+      ((int32_t *) data)[i] = (int32_t) (uint32_t) x;
+    } else {
+      ((int64_t *) data)[i] = (int64_t) x;
+    }
+  }
+  scm_object *v = new(type);
+  v->vec_data = data;
+  v->vec_len = n;
+  return made(slot, v, label);
+}
+
+static void read_object(scm_object **slot) {
+  int op = get_byte(), label = op == F_LABEL;
+  if (label) {
+    op = get_byte();
+  }
+
+  switch (op) {
+    case F_FIXNUM: {
+      uint64_t z = get_varint();
+      *slot = make_integer((intptr_t) (z >> 1) ^ -(intptr_t) (z & 1));
+      break;
+    }
+    case F_CHAR:
+      *slot = new_char((char) get_byte());
+      break;
+    case F_TRUE:
+      *slot = scm_t;
+      break;
+    case F_FALSE:
+      *slot = scm_f;
+      break;
+    case F_NIL:
+      *slot = scm_nil;
+      break;
+    case F_REF: {
+      uint64_t i = get_varint();
+      if (i >= r.count) {
+        errx(1, "fasl-read: bad reference");
+      }
+      *slot = r.objs[i];
+      break;
+    }
+    case F_BIGNUM: {
+      int negative = get_byte();
+      size_t n = get_varint();
+      uint32_t *limbs = malloc((n ? n : 1) * sizeof(*limbs));
+      if (!limbs) {
+        err(1, "failed to allocate bignum of %zu limbs", n);
+      }
+      for (size_t i = 0; i < n; i++) {
+        limbs[i] = (uint32_t) le(get_bytes(4), 4);
+      }
+      if (n < 2 || !limbs[n - 1]) {
+        errx(1, "fasl-read: bad bignum");
+      }
+      scm_object *o = new(SCHEME_BIGNUM);
+      stats.bytes[SCHEME_BIGNUM] += n * sizeof(*limbs);
+      o->big_limbs = limbs;
+      o->big_len = n;
+      o->big_sign = negative ? -1 : 1;
+      made(slot, o, label);
+      break;
+    }
+    case F_STRING: {
+      size_t n = get_varint();
+      made(slot, new_string(get_string(n), n), label);
+      break;
+    }
+    case F_SYMBOL: {
+      size_t n = get_varint();
+      made(slot, intern(get_bytes(n), n), label);
+      break;
+    }
+    case F_GENSYM: {
+      char *name = get_string(get_varint());
+      made(slot, new_symbol(name), label);
+      free(name);
+      break;
+    }
+    case F_CONS: {
+      scm_object *o = made(slot, cons(scm_nil, scm_nil), label);
+      hole(&o->cdr);
+      hole(&o->car);
+      break;
+    }
+    case F_VECTOR: {
+      size_t n = get_varint();
+      scm_object *o = made(slot, new_vector(n, scm_nil), label);
+      for (size_t i = n; i-- > 0;) {
+        hole(&o->slots[i]);
+      }
+      break;
+    }
+    case F_S32VECTOR:
+      read_numvec(slot, label, SCHEME_S32VECTOR, 4);
+      break;
+    case F_S64VECTOR:
+      read_numvec(slot, label, SCHEME_S64VECTOR, 8);
+      break;
+    case F_HASHTABLE: {
+      int kind = get_byte();
+      size_t n = get_varint();
+      if (kind > 2) {
+        errx(1, "fasl-read: bad hash table kind");
+      }
+      scm_object *o = new(SCHEME_HASHTABLE);
+      hashtab_restore(o, kind);
+      made(slot, o, label);
+      /* equal tables hash keys by content, so entries go in once the keys are complete */
+      scm_object *entries = new_vector(2 * n, scm_nil);
+      if (r.ntables + 2 > r.tables_cap) {
+        r.tables = grow(r.tables, &r.tables_cap, sizeof(*r.tables));
+      }
+      r.tables[r.ntables++] = o;
+      r.tables[r.ntables++] = entries;
+      for (size_t i = 2 * n; i-- > 0;) {
+        hole(&entries->slots[i]);
+      }
+      break;
+    }
+    default:
+      errx(1, "fasl-read: bad data");
+  }
+}
+
+scm_object *fasl_decode(struct text_source *src) {
+  static int registered;
+  if (!registered) {
+    gc_tracer(fasl_trace);
+    registered = 1;
+  }
+
+  r.src = src;
+  if (!more()) {
+    return NULL;
+  }
+  if (memcmp(get_bytes(4), FASL_MAGIC, 4)) {
+    errx(1, "fasl-read: not fasl data");
+  }
+  if (get_byte() != FASL_VERSION) {
+    errx(1, "fasl-read: unsupported fasl version");
+  }
+
+  r.root = scm_nil;
+  hole(&r.root);
+  while (r.nholes > 0) {
+    read_object(r.holes[--r.nholes]);
+  }
+  for (size_t i = 0; i < r.ntables; i += 2) {
+    scm_object *entries = r.tables[i + 1];
+    for (size_t j = 0; j < entries->nslots; j += 2) {
+      hashtab_set(r.tables[i], entries->slots[j], entries->slots[j + 1]);
+    }
+  }
+
+  free(r.objs);
+  free(r.holes);
+  free(r.tables);
+  free(r.scratch);
+  scm_object *result = r.root;
+  memset(&r, 0, sizeof(r));
+  return result;
+}
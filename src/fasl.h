@@ -0,0 +1,12 @@
+#ifndef FASL_H_
+#define FASL_H_
+
+#include "scheme.h"
+#include "reader.h"
+
+/* a malloc'd buffer of len bytes */
+char *fasl_encode(scm_object *, size_t *len);
+/* the next datum from src, or NULL at the end of it */
+scm_object *fasl_decode(struct text_source *src);
+
+#endif /* FASL_H_ */
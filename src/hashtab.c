@@ -0,0 +1,399 @@
+#include "hashtab.h"
+#include "lib.h"
+
+/*
+ * Hash tables keyed by eq?, eqv? or equal?, using open addressing with
+ * linear probing. The collector never moves cells, so eq tables can hash
+ * on the address.
+ *
+ * Growing doesn't rehash in one go: the full array becomes `old` and every
+ * later operation moves a few of its slots into the new one, so the cost of
+ * a resize is spread over the operations that follow it. Until `old` has
+ * been drained, lookups check both arrays; a key lives in only one of them.
+ */
+
+#define MIGRATE_STEP 64
+#define EQUAL_BUDGET 64 /* nodes of a key equal-hash looks at */
+#define MIN_CAPACITY 8
+
+/* deleted slots keep the probe chain going */
+#define TOMBSTONE SCM_UNBOUND
+#define LIVE(K) ((K) && (K) != TOMBSTONE)
+
+enum ht_kind { HT_EQ, HT_EQV, HT_EQUAL };
+
+struct ht_entry {
+  scm_object *key, *value;
+  uint64_t hash;
+};
+
+struct ht_array {
+  struct ht_entry *entries;
+  size_t cap, used; /* used counts tombstones too */
+};
+
+struct hash_table {
+  enum ht_kind kind;
+  size_t count;
+  struct ht_array cur, old;
+  size_t migrate; /* next slot of old to move */
+};
+
+static uint64_t mix(uint64_t h) {
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ull;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebull;
+  return h ^ (h >> 31);
+}
+
+static uint64_t hash_bytes(const void *p, size_t len) {
+  const unsigned char *s = p;
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < len; i++) {
+    h = (h ^ s[i]) * 1099511628211ull;
+  }
+  return h;
+}
+
+static uint64_t hash_eqv(scm_object *o) {
+  if (TAG(o) == SCHEME_BIGNUM) {
+    return mix(hash_bytes(o->big_limbs, o->big_len * sizeof(*o->big_limbs)) ^ (uint64_t) o->big_sign);
+  }
+  return mix((uintptr_t) o);
+}
+
+/* stops descending after EQUAL_BUDGET nodes, which also bounds cyclic keys */
+static uint64_t hash_equal(scm_object *o, int *budget) {
+  if (--*budget < 0) {
+    return 0;
+  }
+  switch (TAG(o)) {
+    case SCHEME_STRING:
+      return mix(hash_bytes(o->buffer, o->length));
+    case SCHEME_CONS: {
+      uint64_t h = hash_equal(CAR(o), budget);
+      return mix(h * 31 + hash_equal(CDR(o), budget));
+    }
+    case SCHEME_VECTOR: {
+      uint64_t h = o->nslots;
+      for (size_t i = 0; i < o->nslots && *budget > 0; i++) {
+        h = h * 31 + hash_equal(o->slots[i], budget);
+      }
+      return mix(h);
+    }
+    default:
+      return hash_eqv(o);
+  }
+}
+
+static uint64_t hash_key(struct hash_table *t, scm_object *key) {
+  int budget = EQUAL_BUDGET;
+  switch (t->kind) {
+    case HT_EQ: return mix((uintptr_t) key);
+    case HT_EQV: return hash_eqv(key);
+    default: return hash_equal(key, &budget);
+  }
+}
+
+static int same_key(struct hash_table *t, scm_object *a, scm_object *b) {
+  switch (t->kind) {
+    case HT_EQ: return a == b;
+    case HT_EQV: return scm_eqv(a, b);
+    default: return scm_equal(a, b);
+  }
+}
+
+static struct ht_entry *find(struct hash_table *t, struct ht_array *a, scm_object *key, uint64_t hash) {
+  if (!a->entries) {
+    return NULL;
+  }
+  size_t mask = a->cap - 1;
+  for (size_t i = hash & mask;; i = (i + 1) & mask) {
+    struct ht_entry *e = &a->entries[i];
+    if (!e->key) {
+      return NULL;
+    }
+    if (e->key != TOMBSTONE && e->hash == hash && same_key(t, e->key, key)) {
+      return e;
+    }
+  }
+}
+
+/* the key must not be present already */
+static void insert(struct ht_array *a, scm_object *key, scm_object *value, uint64_t hash) {
+  size_t mask = a->cap - 1, i = hash & mask;
+  while (LIVE(a->entries[i].key)) {
+    i = (i + 1) & mask;
+  }
+  if (!a->entries[i].key) {
+    a->used++;
+  }
+  a->entries[i] = (struct ht_entry) { key, value, hash };
+}
+
+static void migrate(struct hash_table *t, size_t n) {
+  if (!t->old.entries) {
+    return;
+  }
+  for (; n > 0 && t->migrate < t->old.cap; n--, t->migrate++) {
+    struct ht_entry *e = &t->old.entries[t->migrate];
+    if (LIVE(e->key)) {
+      insert(&t->cur, e->key, e->value, e->hash);
+    }
+  }
+  if (t->migrate == t->old.cap) {
+    free(t->old.entries);
+    t->old = (struct ht_array) { 0 };
+    t->migrate = 0;
+  }
+}
+
+static void alloc_array(struct ht_array *a, size_t cap) {
+  if (!(a->entries = calloc(cap, sizeof(*a->entries)))) {
+    err(1, "failed to allocate hash table of %zu entries", cap);
+  }
+  a->cap = cap;
+  a->used = 0;
+}
+
+/*
+ * Makes room for one more insert into cur, starting a migration if it's
+ * full. The new array is sized for every live entry, so it starts at most
+ * half full. Operations drain old MIGRATE_STEP slots at a time, but inserts
+ * made from C don't, so old may still hold entries when cur fills up again:
+ * those move straight into the new array, and the full cur becomes old.
+ */
+static void reserve(struct hash_table *t) {
+  if ((t->cur.used + 1) * 4 <= t->cur.cap * 3) {
+    return;
+  }
+
+  size_t cap = MIN_CAPACITY;
+  while (cap < (t->count + 1) * 2) {
+    cap *= 2;
+  }
+  struct ht_array full = t->cur;
+  alloc_array(&t->cur, cap);
+  migrate(t, SIZE_MAX);
+  t->old = full;
+  t->migrate = 0;
+}
+
+static struct ht_entry *lookup(struct hash_table *t, scm_object *key, uint64_t hash) {
+  struct ht_entry *e = find(t, &t->cur, key, hash);
+  return e ? e : find(t, &t->old, key, hash);
+}
+
+static struct hash_table *alloc_table(enum ht_kind kind) {
+  struct hash_table *t = calloc(1, sizeof(*t));
+  if (!t) {
+    err(1, "failed to allocate hash table");
+  }
+  t->kind = kind;
+  alloc_array(&t->cur, MIN_CAPACITY);
+  return t;
+}
+
+static scm_object *new_table(enum ht_kind kind) {
+  struct hash_table *t = alloc_table(kind);
+  scm_object *o = new(SCHEME_HASHTABLE);
+  o->table = t;
+  return o;
+}
+
+static void put(struct hash_table *t, scm_object *key, scm_object *value) {
+  uint64_t hash = hash_key(t, key);
+  struct ht_entry *e = find(t, &t->cur, key, hash);
+  if (e) {
+    e->value = value;
+    return;
+  }
+  /* a key still waiting in old moves across now */
+  if ((e = find(t, &t->old, key, hash))) {
+    e->key = TOMBSTONE;
+    e->value = NULL;
+    t->count--;
+  }
+  reserve(t);
+  insert(&t->cur, key, value, hash);
+  t->count++;
+}
+
+static struct hash_table *check_table(scm_object *o, const char *who) {
+  if (TAG(o) != SCHEME_HASHTABLE) {
+    errx(1, "%s: expected hash-table, got %s", who, tag_str(TAG(o)));
+  }
+  migrate(o->table, MIGRATE_STEP);
+  return o->table;
+}
+
+void hashtab_mark(scm_object *o) {
+  struct hash_table *t = o->table;
+  struct ht_array *arrays[] = { &t->cur, &t->old };
+  for (size_t i = 0; i < 2; i++) {
+    for (size_t j = 0; j < arrays[i]->cap; j++) {
+      gc_mark(arrays[i]->entries[j].key);
+      gc_mark(arrays[i]->entries[j].value);
+    }
+  }
+}
+
+void hashtab_free(scm_object *o) {
+  if (o->table) {
+    free(o->table->cur.entries);
+    free(o->table->old.entries);
+    free(o->table);
+  }
+}
+
+/* runs BODY with E bound to every live entry, in no particular order */
+#define EACH(T, E, BODY) \
+  for (size_t each_i = 0; each_i < 2; each_i++) { \
+    struct ht_array *each_a = each_i ? &(T)->old : &(T)->cur; \
+    for (size_t each_j = 0; each_j < each_a->cap; each_j++) { \
+      struct ht_entry *E = &each_a->entries[each_j]; \
+      if (LIVE(E->key)) { \
+        BODY \
+      } \
+    } \
+  }
+
+/* images store a table as its kind and entries, and rehash it on restore */
+
+int hashtab_kind(scm_object *o) {
+  return o->table->kind;
+}
+
+void hashtab_each(scm_object *o, void (*fn)(scm_object *key, scm_object *value, void *), void *data) {
+  EACH(o->table, e, fn(e->key, e->value, data);)
+}
+
+void hashtab_restore(scm_object *o, int kind) {
+  o->table = alloc_table(kind);
+}
+
+void hashtab_set(scm_object *o, scm_object *key, scm_object *value) {
+  migrate(o->table, MIGRATE_STEP);
+  put(o->table, key, value);
+}
+
+static scm_object *pscm_make_eq_table(UNUSED int argc, UNUSED scm_object **argv) {
+  return new_table(HT_EQ);
+}
+
+static scm_object *pscm_make_eqv_table(UNUSED int argc, UNUSED scm_object **argv) {
+  return new_table(HT_EQV);
+}
+
+static scm_object *pscm_make_equal_table(UNUSED int argc, UNUSED scm_object **argv) {
+  return new_table(HT_EQUAL);
+}
+
+static scm_object *pscm_is_table(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(TAG(argv[0]) == SCHEME_HASHTABLE);
+}
+
+/* (hash-table-ref table key [failure]) calls failure when key is missing */
+static scm_object *pscm_table_ref(int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-ref");
+  struct ht_entry *e = lookup(t, argv[1], hash_key(t, argv[1]));
+  if (e) {
+    return e->value;
+  }
+  if (argc < 3) {
+    errx(1, "hash-table-ref: key not found");
+  }
+  return scm_apply(argv[2], 0, NULL);
+}
+
+static scm_object *pscm_table_ref_default(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-ref/default");
+  struct ht_entry *e = lookup(t, argv[1], hash_key(t, argv[1]));
+  return e ? e->value : argv[2];
+}
+
+static scm_object *pscm_table_contains(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-contains?");
+  return SCM_BOOL(lookup(t, argv[1], hash_key(t, argv[1])));
+}
+
+static scm_object *pscm_table_set(UNUSED int argc, scm_object **argv) {
+  put(check_table(argv[0], "hash-table-set!"), argv[1], argv[2]);
+  return scm_t;
+}
+
+static scm_object *pscm_table_delete(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-delete!");
+  struct ht_entry *e = lookup(t, argv[1], hash_key(t, argv[1]));
+  if (!e) {
+    return scm_f;
+  }
+  e->key = TOMBSTONE;
+  e->value = NULL;
+  t->count--;
+  return scm_t;
+}
+
+static scm_object *pscm_table_size(UNUSED int argc, scm_object **argv) {
+  return new_integer(check_table(argv[0], "hash-table-size")->count);
+}
+
+static scm_object *pscm_table_clear(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-clear!");
+  free(t->cur.entries);
+  free(t->old.entries);
+  t->old = (struct ht_array) { 0 };
+  t->migrate = t->count = 0;
+  alloc_array(&t->cur, MIN_CAPACITY);
+  return scm_t;
+}
+
+static scm_object *pscm_table_keys(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-keys");
+  scm_object *list = scm_nil;
+  EACH(t, e, list = cons(e->key, list);)
+  return list;
+}
+
+static scm_object *pscm_table_values(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table-values");
+  scm_object *list = scm_nil;
+  EACH(t, e, list = cons(e->value, list);)
+  return list;
+}
+
+static scm_object *pscm_table_to_alist(UNUSED int argc, scm_object **argv) {
+  struct hash_table *t = check_table(argv[0], "hash-table->alist");
+  scm_object *list = scm_nil;
+  EACH(t, e, list = cons(cons(e->key, e->value), list);)
+  return list;
+}
+
+/* (hash-table-walk table proc) calls (proc key value) on a snapshot of the entries */
+static scm_object *pscm_table_walk(UNUSED int argc, scm_object **argv) {
+  scm_object *alist = pscm_table_to_alist(1, argv);
+  for (; alist != scm_nil; alist = CDR(alist)) {
+    scm_object *kv[] = { CAAR(alist), CDAR(alist) };
+    scm_apply(argv[1], 2, kv);
+  }
+  return scm_t;
+}
+
+void hashtab_init(void) {
+  add_procedure("make-eq-hash-table", pscm_make_eq_table, 0, 0);
+  add_procedure("make-eqv-hash-table", pscm_make_eqv_table, 0, 0);
+  add_procedure("make-equal-hash-table", pscm_make_equal_table, 0, 0);
+  add_procedure("hash-table?", pscm_is_table, 1, 1);
+  add_procedure("hash-table-ref", pscm_table_ref, 2, 3);
+  add_procedure("hash-table-ref/default", pscm_table_ref_default, 3, 3);
+  add_procedure("hash-table-contains?", pscm_table_contains, 2, 2);
+  add_procedure("hash-table-set!", pscm_table_set, 3, 3);
+  add_procedure("hash-table-delete!", pscm_table_delete, 2, 2);
+  add_procedure("hash-table-size", pscm_table_size, 1, 1);
+  add_procedure("hash-table-clear!", pscm_table_clear, 1, 1);
+  add_procedure("hash-table-keys", pscm_table_keys, 1, 1);
+  add_procedure("hash-table-values", pscm_table_values, 1, 1);
+  add_procedure("hash-table->alist", pscm_table_to_alist, 1, 1);
+  add_procedure("hash-table-walk", pscm_table_walk, 2, 2);
+}
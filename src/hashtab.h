@@ -0,0 +1,15 @@
+#ifndef HASHTAB_H_
+#define HASHTAB_H_
+
+#include "scheme.h"
+
+void hashtab_init(void);
+void hashtab_mark(scm_object *);
+void hashtab_free(scm_object *);
+
+int hashtab_kind(scm_object *);
+void hashtab_each(scm_object *, void (*fn)(scm_object *key, scm_object *value, void *), void *);
+void hashtab_restore(scm_object *, int kind);
+void hashtab_set(scm_object *, scm_object *key, scm_object *value);
+
+#endif /* HASHTAB_H_ */
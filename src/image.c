@@ -0,0 +1,459 @@
+#include "image.h"
+#include "lib.h"
+#include "expand.h"
+#include "hashtab.h"
+#include "port.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Heap images. An image holds everything reachable from the symbol table,
+ * which is where globals live, and from the macro table, written out cell
+ * for cell. Loading one maps the file, takes its cells into the heap where
+ * they lie and fixes up their pointers.
+ *
+ * Inside the image a reference to a cell is its byte offset from the first
+ * cell: a multiple of the cell size, so it never looks like an immediate.
+ * Cell 0 is left unused, keeping 0 for NULL. The buffers cells point to
+ * follow the cells and are referred to by file offset; the ones the
+ * collector frees are copied out on load, while interned symbol names, which
+ * are never freed, are used from the mapping. Native procedures are stored
+ * by name, and hash tables as their entries since eq tables hash addresses.
+ */
+
+#define IMAGE_MAGIC "PONZIIMG"
+#define IMAGE_VERSION 3
+
+struct image_header {
+  char magic[8];
+  uint32_t version, cell_size;
+  uint64_t ncells, cells_off;
+  uint64_t symbols_off, nsymbols;
+  uint64_t macros_off, nmacros; /* name and expander refs, in pairs */
+};
+
+#define ALIGN8(N) (((N) + 7) & ~(uint64_t) 7)
+
+/* dumping */
+
+static struct {
+  scm_object **objs; /* in image order, objs[0] unused */
+  size_t count, cap;
+  scm_object **keys; /* objs index by address, open addressing */
+  size_t *index, map_cap;
+  char *data; /* everything after the cells */
+  size_t data_len, data_cap;
+  uint64_t data_off;
+} d;
+
+static size_t map_slot(scm_object *o) {
+  size_t mask = d.map_cap - 1, i = ((uintptr_t) o * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+  while (d.keys[i] && d.keys[i] != o) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static void map_grow(void) {
+  scm_object **keys = d.keys;
+  size_t *index = d.index, cap = d.map_cap;
+  d.map_cap = cap ? cap * 2 : 4096;
+  d.keys = calloc(d.map_cap, sizeof(*d.keys));
+  d.index = malloc(d.map_cap * sizeof(*d.index));
+  if (!d.keys || !d.index) {
+    err(1, "failed to grow image object map");
+  }
+  for (size_t i = 0; i < cap; i++) {
+    if (keys[i]) {
+      size_t j = map_slot(keys[i]);
+      d.keys[j] = keys[i];
+      d.index[j] = index[i];
+    }
+  }
+  free(keys);
+  free(index);
+}
+
+static void visit(scm_object *o) {
+  if (!o || IS_IMMEDIATE(o)) {
+    return;
+  }
+  if (2 * (d.count + 1) > d.map_cap) {
+    map_grow();
+  }
+  size_t i = map_slot(o);
+  if (d.keys[i]) {
+    return;
+  }
+  if (d.count == d.cap) {
+    d.cap = d.cap ? d.cap * 2 : 4096;
+    if (!(d.objs = realloc(d.objs, d.cap * sizeof(*d.objs)))) {
+      err(1, "failed to grow image object list");
+    }
+  }
+  d.keys[i] = o;
+  d.index[i] = d.count;
+  d.objs[d.count++] = o;
+}
+
+static void visit_entry(scm_object *key, scm_object *value, UNUSED void *data) {
+  visit(key);
+  visit(value);
+}
+
+static void visit_children(scm_object *o) {
+  switch (o->tag) {
+    case SCHEME_CONS:
+      visit(o->car);
+      visit(o->cdr);
+      break;
+    case SCHEME_CLOSURE:
+      visit(o->env);
+      visit(o->expr);
+      break;
+    case SCHEME_KNOT:
+      visit(o->fwd);
+      break;
+    case SCHEME_SYMBOL:
+      visit(o->sym_global);
+      break;
+    case SCHEME_FRAME:
+    case SCHEME_VECTOR:
+    case SCHEME_CONTINUATION:
+      for (size_t i = 0; i < o->nslots; i++) {
+        visit(o->slots[i]);
+      }
+      break;
+    case SCHEME_HASHTABLE:
+      hashtab_each(o, visit_entry, NULL);
+      break;
+    default:
+      break;
+  }
+}
+
+static uint64_t ref(scm_object *o) {
+  if (!o || IS_IMMEDIATE(o)) {
+    return (uintptr_t) o;
+  }
+  return d.index[map_slot(o)] * sizeof(scm_object);
+}
+
+/* room for len bytes of data, returning its file offset */
+static uint64_t reserve(size_t len) {
+  size_t at = d.data_len;
+  d.data_len = ALIGN8(at + len);
+  if (d.data_len > d.data_cap) {
+    while (d.data_len > d.data_cap) {
+      d.data_cap = d.data_cap ? d.data_cap * 2 : 65536;
+    }
+    if (!(d.data = realloc(d.data, d.data_cap))) {
+      err(1, "failed to grow image data");
+    }
+  }
+  memset(d.data + at, 0, d.data_len - at);
+  return d.data_off + at;
+}
+
+static char *data_at(uint64_t off) {
+  return d.data + (off - d.data_off);
+}
+
+static uint64_t put_bytes(const void *p, size_t len, size_t extra) {
+  uint64_t off = reserve(len + extra);
+  memcpy(data_at(off), p, len);
+  return off;
+}
+
+static uint64_t put_refs(scm_object **objs, size_t n) {
+  uint64_t off = reserve(n * sizeof(uint64_t));
+  for (size_t i = 0; i < n; i++) {
+    ((uint64_t *) data_at(off))[i] = ref(objs[i]);
+  }
+  return off;
+}
+
+static void put_entry(scm_object *key, scm_object *value, void *data) {
+  uint64_t **out = data;
+  *(*out)++ = ref(key);
+  *(*out)++ = ref(value);
+}
+
+static void count_entry(UNUSED scm_object *key, UNUSED scm_object *value, void *data) {
+  (*(size_t *) data)++;
+}
+
+/* c is o's copy in the image */
+static void encode(scm_object *c, scm_object *o) {
+  c->mark = 0;
+  switch (o->tag) {
+    case SCHEME_CONS:
+      c->car = (scm_object *) ref(o->car);
+      c->cdr = (scm_object *) ref(o->cdr);
+      break;
+    case SCHEME_CLOSURE:
+      c->env = (scm_object *) ref(o->env);
+      c->expr = (scm_object *) ref(o->expr);
+      break;
+    case SCHEME_KNOT:
+      c->fwd = (scm_object *) ref(o->fwd);
+      break;
+    case SCHEME_SYMBOL:
+      c->sym_value = (char *) put_bytes(o->sym_value, strlen(o->sym_value) + 1, 0);
+      c->sym_global = (scm_object *) ref(o->sym_global);
+      break;
+    case SCHEME_STRING:
+      c->buffer = (char *) put_bytes(o->buffer, o->length, 1);
+      break;
+    case SCHEME_BIGNUM:
+      c->big_limbs = (uint32_t *) put_bytes(o->big_limbs, o->big_len * sizeof(*o->big_limbs), 0);
+      break;
+    case SCHEME_S32VECTOR:
+      c->vec_data = (void *) put_bytes(o->vec_data, o->vec_len * sizeof(int32_t), 0);
+      break;
+    case SCHEME_S64VECTOR:
+      c->vec_data = (void *) put_bytes(o->vec_data, o->vec_len * sizeof(int64_t), 0);
+      break;
+    case SCHEME_FRAME:
+    case SCHEME_VECTOR:
+    case SCHEME_CONTINUATION:
+      c->slots = (scm_object **) put_refs(o->slots, o->nslots);
+      break;
+    case SCHEME_PROC: {
+      const char *name = procedure_name(o->procedure);
+      if (!name) {
+        errx(1, "can't dump native procedure %p without a name", (void *) (uintptr_t) o->procedure);
+      }
+      c->procedure = (scm_proc) (uintptr_t) put_bytes(name, strlen(name) + 1, 0);
+      break;
+    }
+    case SCHEME_HASHTABLE: {
+      size_t n = 0;
+      hashtab_each(o, count_entry, &n);
+      uint64_t off = reserve((2 + 2 * n) * sizeof(uint64_t));
+      uint64_t *out = (uint64_t *) data_at(off);
+      *out++ = hashtab_kind(o);
+      *out++ = n;
+      hashtab_each(o, put_entry, &out);
+      c->table = (struct hash_table *) (uintptr_t) off;
+      break;
+    }
+    case SCHEME_PORT:
+      c->port = NULL;
+      break;
+    default:
+      break;
+  }
+}
+
+static scm_object **roots;
+static size_t nroots, roots_cap;
+
+static void add_root(scm_object *o) {
+  if (nroots == roots_cap) {
+    roots_cap = roots_cap ? roots_cap * 2 : 1024;
+    if (!(roots = realloc(roots, roots_cap * sizeof(*roots)))) {
+      err(1, "failed to grow image roots");
+    }
+  }
+  roots[nroots++] = o;
+}
+
+static void add_macro_roots(scm_object *name, scm_object *expander) {
+  add_root(name);
+  add_root(expander);
+}
+
+static void write_all(int fd, const void *buf, size_t len, const char *path) {
+  for (const char *p = buf; len > 0;) {
+    ssize_t n = write(fd, p, len);
+    if (n == -1) {
+      err(1, "failed to write image %s", path);
+    }
+    p += n;
+    len -= n;
+  }
+}
+
+void image_dump(const char *path) {
+  d.cap = 4096;
+  if (!(d.objs = malloc(d.cap * sizeof(*d.objs)))) {
+    err(1, "failed to allocate image object list");
+  }
+  d.count = 1;
+  nroots = 0;
+  each_symbol(add_root);
+  size_t nsymbols = nroots;
+  each_macro(add_macro_roots);
+  for (size_t i = 0; i < nroots; i++) {
+    visit(roots[i]);
+  }
+  for (size_t i = 1; i < d.count; i++) {
+    visit_children(d.objs[i]);
+  }
+
+  struct image_header h = { .version = IMAGE_VERSION, .cell_size = sizeof(scm_object), .ncells = d.count };
+  memcpy(h.magic, IMAGE_MAGIC, sizeof(h.magic));
+  h.cells_off = ALIGN8(sizeof(h));
+  d.data_off = h.cells_off + d.count * sizeof(scm_object);
+
+  scm_object *cells = calloc(d.count, sizeof(scm_object));
+  if (!cells) {
+    err(1, "failed to allocate image of %zu cells", d.count);
+  }
+  cells[0].tag = SCHEME_FREE;
+  for (size_t i = 1; i < d.count; i++) {
+    cells[i] = *d.objs[i];
+    encode(&cells[i], d.objs[i]);
+  }
+  h.symbols_off = put_refs(roots, nsymbols);
+  h.nsymbols = nsymbols;
+  h.macros_off = put_refs(roots + nsymbols, nroots - nsymbols);
+  h.nmacros = (nroots - nsymbols) / 2;
+
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd == -1) {
+    err(1, "failed to create image %s", path);
+  }
+  char pad[8] = { 0 };
+  write_all(fd, &h, sizeof(h), path);
+  write_all(fd, pad, h.cells_off - sizeof(h), path);
+  write_all(fd, cells, d.count * sizeof(scm_object), path);
+  write_all(fd, d.data, d.data_len, path);
+  if (close(fd) == -1) {
+    err(1, "failed to write image %s", path);
+  }
+
+  free(cells);
+  free(d.objs);
+  free(d.keys);
+  free(d.index);
+  free(d.data);
+  memset(&d, 0, sizeof(d));
+}
+
+/* loading */
+
+static char *copy_out(const void *p, size_t len) {
+  char *copy = malloc(len ? len : 1);
+  if (!copy) {
+    err(1, "failed to load image buffer of %zu bytes", len);
+  }
+  return memcpy(copy, p, len);
+}
+
+void image_load(const char *path) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd == -1 || fstat(fd, &st) == -1) {
+    err(1, "failed to open image %s", path);
+  }
+  char *base = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    err(1, "failed to map image %s", path);
+  }
+
+  struct image_header *h = (struct image_header *) base;
+  if ((size_t) st.st_size < sizeof(*h) || memcmp(h->magic, IMAGE_MAGIC, sizeof(h->magic))
+      || h->version != IMAGE_VERSION || h->cell_size != sizeof(scm_object)
+      || h->cells_off + h->ncells * sizeof(scm_object) > (uint64_t) st.st_size) {
+    errx(1, "%s is not a heap image for this build", path);
+  }
+
+  scm_object *cells = (scm_object *) (base + h->cells_off);
+#define CELL(X) (!(X) || IS_IMMEDIATE(X) ? (X) : (scm_object *) ((char *) cells + (uintptr_t) (X)))
+#define DATA(X) (base + (uintptr_t) (X))
+  for (size_t i = 1; i < h->ncells; i++) {
+    scm_object *o = &cells[i];
+    switch (o->tag) {
+      case SCHEME_CONS:
+        o->car = CELL(o->car);
+        o->cdr = CELL(o->cdr);
+        break;
+      case SCHEME_CLOSURE:
+        o->env = CELL(o->env);
+        o->expr = CELL(o->expr);
+        break;
+      case SCHEME_KNOT:
+        o->fwd = CELL(o->fwd);
+        break;
+      case SCHEME_SYMBOL:
+        o->sym_value = o->sym_interned ? DATA(o->sym_value) : strdup(DATA(o->sym_value));
+        o->sym_global = CELL(o->sym_global);
+        break;
+      case SCHEME_STRING:
+        o->buffer = copy_out(DATA(o->buffer), o->length + 1);
+        break;
+      case SCHEME_BIGNUM:
+        o->big_limbs = (uint32_t *) copy_out(DATA(o->big_limbs), o->big_len * sizeof(*o->big_limbs));
+        break;
+      case SCHEME_S32VECTOR:
+        o->vec_data = copy_out(DATA(o->vec_data), o->vec_len * sizeof(int32_t));
+        break;
+      case SCHEME_S64VECTOR:
+        o->vec_data = copy_out(DATA(o->vec_data), o->vec_len * sizeof(int64_t));
+        break;
+      case SCHEME_FRAME:
+      case SCHEME_VECTOR:
+      case SCHEME_CONTINUATION: {
+        scm_object **slots = (scm_object **) DATA(o->slots);
+        if (!(o->slots = malloc(o->nslots * sizeof(*o->slots))) && o->nslots) {
+          err(1, "failed to load image slots");
+        }
+        for (size_t j = 0; j < o->nslots; j++) {
+          o->slots[j] = CELL(slots[j]);
+        }
+        break;
+      }
+      case SCHEME_PROC: {
+        const char *name = DATA(o->procedure);
+        if (!(o->procedure = named_procedure(name))) {
+          errx(1, "image %s needs native procedure %s", path, name);
+        }
+        break;
+      }
+      case SCHEME_PORT:
+        port_restore(o);
+        break;
+      default:
+        break;
+    }
+  }
+  heap_adopt(cells, h->ncells);
+
+  uint64_t *refs = (uint64_t *) DATA(h->symbols_off);
+  scm_object **syms = malloc(h->nsymbols * sizeof(*syms));
+  if (!syms && h->nsymbols) {
+    err(1, "failed to load image symbols");
+  }
+  for (size_t i = 0; i < h->nsymbols; i++) {
+    syms[i] = CELL((scm_object *) (uintptr_t) refs[i]);
+  }
+  reset_symbols(syms, h->nsymbols);
+  free(syms);
+  intern_syntax();
+
+  refs = (uint64_t *) DATA(h->macros_off);
+  clear_macros();
+  for (size_t i = 0; i < h->nmacros; i++) {
+    define_macro(CELL((scm_object *) (uintptr_t) refs[2 * i]), CELL((scm_object *) (uintptr_t) refs[2 * i + 1]));
+  }
+
+  /* rehash once every key is in place */
+  for (size_t i = 1; i < h->ncells; i++) {
+    scm_object *o = &cells[i];
+    if (o->tag == SCHEME_HASHTABLE) {
+      uint64_t *entries = (uint64_t *) DATA(o->table);
+      hashtab_restore(o, entries[0]);
+      for (size_t j = 0; j < entries[1]; j++) {
+        hashtab_set(o, CELL((scm_object *) (uintptr_t) entries[2 + 2 * j]), CELL((scm_object *) (uintptr_t) entries[3 + 2 * j]));
+      }
+    }
+  }
+#undef CELL
+#undef DATA
+}
@@ -0,0 +1,9 @@
+#ifndef IMAGE_H_
+#define IMAGE_H_
+
+#include "scheme.h"
+
+void image_dump(const char *path);
+void image_load(const char *path);
+
+#endif /* IMAGE_H_ */
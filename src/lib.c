@@ -1,32 +1,39 @@
 #include "reader.h"
 #include "lib.h"
-
-#include <unistd.h>
-#include <fcntl.h>
+#include "analyze.h"
+#include "expand.h"
+#include "vm.h"
+#include "number.h"
+#include "numvec.h"
+#include "hashtab.h"
+#include "port.h"
+#include "printer.h"
+#include "profile.h"
+#include "stats.h"
 
 #define P(TYPE, DISCRIMINANT) \
-  static scm_object *pscm_is_ ## TYPE (scm_object *a, UNUSED scm_object **env) { \
-    assert(scm_len(a) == 1); \
-    return SCM_BOOL(CAR(a)->tag == SCHEME_ ## DISCRIMINANT); \
+  static scm_object *pscm_is_ ## TYPE (UNUSED int argc, scm_object **argv) { \
+    return SCM_BOOL(TAG(argv[0]) == SCHEME_ ## DISCRIMINANT); \
   }
 
-#define O(NAME, OP) \
-  static scm_object *pscm_op_ ## NAME (scm_object *a, UNUSED scm_object **env) { \
-    assert(scm_len(a) == 2); \
-    assert(CAR(a)->tag == SCHEME_INTEGER); \
-    assert(CADR(a)->tag == SCHEME_INTEGER); \
-    return new_integer(CAR(a)->integer_value OP CADR(a)->integer_value); \
+/* left folds; a lone argument is folded into the identity */
+#define O(NAME, FN, IDENTITY) \
+  static scm_object *pscm_op_ ## NAME (int argc, scm_object **argv) { \
+    scm_object *acc = argc <= 1 ? new_integer(IDENTITY) : argv[0]; \
+    for (int i = argc <= 1 ? 0 : 1; i < argc; i++) { \
+      acc = FN(acc, argv[i]); \
+    } \
+    return acc; \
   }
 
 #define C(NAME, OP) \
-  static scm_object *pscm_cmp_ ## NAME (scm_object *a, UNUSED scm_object **env) { \
-    assert(scm_len(a) == 2); \
-    if (CAR(a)->tag == SCHEME_INTEGER && CADR(a)->tag == SCHEME_INTEGER) { \
-      return SCM_BOOL(CAR(a)->integer_value OP CADR(a)->integer_value); \
-    } else if (CAR(a)->tag == SCHEME_CHARACTER && CADR(a)->tag == SCHEME_CHARACTER) { \
-      return SCM_BOOL(CAR(a)->char_value OP CADR(a)->char_value); \
+  static scm_object *pscm_cmp_ ## NAME (UNUSED int argc, scm_object **argv) { \
+    if (is_integer(argv[0]) && is_integer(argv[1])) { \
+      return SCM_BOOL(num_cmp(argv[0], argv[1]) OP 0); \
+    } else if (TAG(argv[0]) == SCHEME_CHARACTER && TAG(argv[1]) == SCHEME_CHARACTER) { \
+      return SCM_BOOL(CHAR_VALUE(argv[0]) OP CHAR_VALUE(argv[1])); \
     } else { \
-      errx(1, "invalid comparison between types %s and %s", tag_str(CAR(a)->tag), tag_str(CADR(a)->tag)); \
+      errx(1, "invalid comparison between types %s and %s", tag_str(TAG(argv[0])), tag_str(TAG(argv[1]))); \
     } \
   }
 
@@ -36,14 +43,12 @@ P(string, STRING)
 P(function, CLOSURE)
 P(procedure, PROC)
 P(char, CHARACTER)
-P(integer, INTEGER)
 P(symbol, SYMBOL)
+P(vector, VECTOR)
 
-O(plus, +)
-O(minus, -)
-O(times, *)
-O(over, /)
-O(rem, %)
+O(plus, num_add, 0)
+O(minus, num_sub, 0)
+O(times, num_mul, 1)
 
 C(lt, <)
 C(gt, >)
@@ -55,62 +60,105 @@ C(gte, >=)
 #undef C
 
 int scm_len(scm_object *n) {
-  assert(n->tag == SCHEME_CONS || n->tag == SCHEME_NIL);
+  assert(TAG(n) == SCHEME_CONS || n == scm_nil);
   int len = 0;
-  while (n->tag == SCHEME_CONS) {
+  while (TAG(n) == SCHEME_CONS) {
     n = CDR(n);
     len++;
   }
   return len;
 }
 
-scm_object *add_procedure(const char *name, scm_proc procedure) {
+/* every native procedure by name, so heap images can refer to them */
+static struct {
+  const char *name;
+  scm_proc procedure;
+} *natives;
+static size_t native_count, native_cap;
+
+const char *procedure_name(scm_proc procedure) {
+  for (size_t i = 0; i < native_count; i++) {
+    if (natives[i].procedure == procedure) {
+      return natives[i].name;
+    }
+  }
+  return NULL;
+}
+
+scm_proc named_procedure(const char *name) {
+  for (size_t i = 0; i < native_count; i++) {
+    if (!strcmp(natives[i].name, name)) {
+      return natives[i].procedure;
+    }
+  }
+  return NULL;
+}
+
+/* max is ARITY_ANY for procedures taking any number of arguments from min up */
+scm_object *add_procedure(const char *name, scm_proc procedure, int min, int max) {
+  if (native_count == native_cap) {
+    native_cap = native_cap ? native_cap * 2 : 256;
+    if (!(natives = realloc(natives, native_cap * sizeof(*natives)))) {
+      err(1, "failed to grow native procedure table");
+    }
+  }
   scm_object *sym = make_symbol((char *) name);
+  /* name may be a scratch buffer; the symbol's copy is never freed */
+  natives[native_count].name = sym->sym_value;
+  natives[native_count++].procedure = procedure;
+
   scm_object *proc = new(SCHEME_PROC);
   proc->procedure = procedure;
-  environment = cons(cons(sym, proc), environment);
+  proc->proc_min = min;
+  proc->proc_max = max;
+  sym->sym_global = proc;
   return proc;
 }
 
-scm_object *pscm_cons(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2);
+scm_object *pscm_cons(UNUSED int argc, scm_object **argv) {
+  return cons(argv[0], argv[1]);
+}
+
+scm_object *pscm_is_integer(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(is_integer(argv[0]));
+}
 
-  return cons(CAR(args), CADR(args));
+scm_object *pscm_op_over(UNUSED int argc, scm_object **argv) {
+  return num_quotient(argv[0], argv[1]);
 }
 
-scm_object *pscm_is_bool(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1);
+scm_object *pscm_op_rem(UNUSED int argc, scm_object **argv) {
+  return num_remainder(argv[0], argv[1]);
+}
 
-  return SCM_BOOL(CAR(args)->tag == SCHEME_TRUE || CAR(args)->tag == SCHEME_FALSE); 
+scm_object *pscm_is_bool(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(TAG(argv[0]) == SCHEME_TRUE || TAG(argv[0]) == SCHEME_FALSE); 
 }
 
-scm_object *pscm_car(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1);
-  if (CAR(args)->tag != SCHEME_CONS) {
-    scm_write(CAR(args));
-    errx(1, "bad argument to car: object %s", tag_str(CAR(args)->tag));
+scm_object *pscm_car(UNUSED int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_CONS) {
+    scm_write(argv[0]);
+    fflush(stdout);
+    errx(1, "bad argument to car: object %s", tag_str(TAG(argv[0])));
   }
 
-  return CAAR(args);
+  return CAR(argv[0]);
 }
 
-scm_object *pscm_cdr(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1);
-  assert(CAR(args)->tag == SCHEME_CONS);
-  if (CAR(args)->tag != SCHEME_CONS) {
-    scm_write(CAR(args));
-    errx(1, "bad argument to cdr: object %s", tag_str(CAR(args)->tag));
+scm_object *pscm_cdr(UNUSED int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_CONS) {
+    scm_write(argv[0]);
+    fflush(stdout);
+    errx(1, "bad argument to cdr: object %s", tag_str(TAG(argv[0])));
   }
 
-  return CDAR(args);
+  return CDR(argv[0]);
 }
 
-scm_object *pscm_setcar(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2);
-
-  scm_object *addr = CAR(args);
-  scm_object *val = CADR(args);
-  if (CAR(args)->tag != SCHEME_CONS) {
+scm_object *pscm_setcar(UNUSED int argc, scm_object **argv) {
+  scm_object *addr = argv[0];
+  scm_object *val = argv[1];
+  if (TAG(argv[0]) != SCHEME_CONS) {
     return scm_f;
   }
   CAR(addr) = val;
@@ -118,12 +166,10 @@ scm_object *pscm_setcar(scm_object *args, UNUSED scm_object **env) {
   return scm_t;
 }
 
-scm_object *pscm_setcdr(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2);
-
-  scm_object *addr = CAR(args);
-  scm_object *val = CADR(args);
-  if (addr->tag != SCHEME_CONS) {
+scm_object *pscm_setcdr(UNUSED int argc, scm_object **argv) {
+  scm_object *addr = argv[0];
+  scm_object *val = argv[1];
+  if (TAG(addr) != SCHEME_CONS) {
     return scm_f;
   }
   CDR(addr) = val;
@@ -131,94 +177,197 @@ scm_object *pscm_setcdr(scm_object *args, UNUSED scm_object **env) {
   return scm_t;
 }
 
-scm_object *pscm_list(scm_object *args, UNUSED scm_object **env) {
-  return args;
+scm_object *pscm_list(int argc, scm_object **argv) {
+  scm_object *list = scm_nil;
+  while (argc--) {
+    list = cons(argv[argc], list);
+  }
+  return list;
 }
 
-scm_object *pscm_id(scm_object *args, UNUSED scm_object **env) {
-  return CAR(args);
+scm_object *pscm_load(UNUSED int argc, scm_object **argv) {
+  scm_object *path = argv[0];
+  assert(TAG(path) == SCHEME_STRING);
+
+  if (!read_file(path->buffer, user_interact)) {
+    err(1, "failed to open file %s for reading", path->buffer);
+  }
+  return scm_t;
+}
+
+scm_object *pscm_write(int argc, scm_object **argv) {
+  for (int i = 0; i < argc; i++) {
+    switch (TAG(argv[i])) {
+      case SCHEME_STRING:
+        printf("%s", argv[i]->buffer);
+        break;
+      case SCHEME_CHARACTER:
+        printf("%c", CHAR_VALUE(argv[i]));
+        break;
+      default: scm_write(argv[i]);
+    }
+  }
+  return new_integer(argc);
 }
 
-scm_object *pscm_load(scm_object *args, scm_object **env) {
-  assert(scm_len(args) == 1);
+scm_object *pscm_error(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_STRING);
 
-  scm_object *path = CAR(args);
-  assert(path->tag == SCHEME_STRING);
-  int linum = 0, colnum = 0;
+  argv[0]->buffer[argv[0]->length] = 0;
+  errx(1, "%s", argv[0]->buffer);
+}
 
-  if ((scheme_input = fopen(path->buffer, "r")) != NULL) {
-    for(;;) {
-      if (peek() == EOF) {
-        break;
+/* identity, except that integers compare by value */
+int scm_eqv(scm_object *a, scm_object *b) {
+  return a == b || (TAG(a) == SCHEME_BIGNUM && TAG(b) == SCHEME_BIGNUM && num_cmp(a, b) == 0);
+}
+
+#define EQUAL_CYCLE_CHECK 1024 /* pairs and vectors equal? takes up before it watches for cycles */
+#define EQUAL_CYCLE_STRIDE 16  /* then one in this many is recorded */
+
+/* the (a, b) pairs and vectors a large equal? has taken up */
+static struct seen_pair {
+  scm_object *a, *b;
+} *seen;
+static size_t seen_cap, seen_count;
+
+/* records that a and b are being compared, or returns 0 if they already are */
+static int first_visit(scm_object *a, scm_object *b) {
+  if (seen_count * 2 >= seen_cap) {
+    struct seen_pair *old = seen;
+    size_t old_cap = seen_cap;
+    seen_cap = seen_cap ? seen_cap * 2 : 1024;
+    if (!(seen = calloc(seen_cap, sizeof(*seen)))) {
+      err(1, "failed to grow equal? table");
+    }
+    seen_count = 0;
+    for (size_t i = 0; i < old_cap; i++) {
+      if (old[i].a) {
+        first_visit(old[i].a, old[i].b);
       }
-      user_interact(scm_read(&linum, &colnum), env);
     }
-    scheme_input = stdin;
-    return scm_t;
-  } else {
-    err(1, "failed to open file %s for reading", path->buffer);
+    free(old);
   }
+  size_t mask = seen_cap - 1;
+  size_t i = (((uintptr_t) a >> 4) * 31 + ((uintptr_t) b >> 4)) * 0x9e3779b97f4a7c15u >> 32 & mask;
+  for (; seen[i].a; i = (i + 1) & mask) {
+    if (seen[i].a == a && seen[i].b == b) {
+      return 0;
+    }
+  }
+  seen[i].a = a;
+  seen[i].b = b;
+  seen_count++;
+  return 1;
 }
 
-scm_object *pscm_write(scm_object *args, UNUSED scm_object **env) {
-  int n = 0;
-  while (args->tag != SCHEME_NIL) {
-    switch (CAR(args)->tag) {
-      case SCHEME_STRING:
-        printf("%s", CAR(args)->buffer);
+/*
+ * eqv, or strings, pairs and vectors with equal contents. Pending cdrs and
+ * vector tails wait on an explicit stack, so neither long lists nor deep
+ * nesting use the C stack. Once a comparison has taken up enough pairs
+ * and vectors that they may be cyclic, it records some of them, and one
+ * met again is taken as equal: its first visit compares it in full. A walk
+ * round a cycle would record some pair twice, so it ends.
+ */
+static int equal_walk(scm_object *a, scm_object *b) {
+  static struct {
+    scm_object *a, *b;
+    size_t next; /* index of the next vector slot; unused for a pair's cdrs */
+  } *pending;
+  static size_t cap;
+  size_t top = 0, taken = 0;
+
+  for (;;) {
+    if (!scm_eqv(a, b)) {
+      if (TAG(a) != TAG(b)) {
+        return 0;
+      }
+      switch (TAG(a)) {
+        case SCHEME_STRING:
+          if (a->length != b->length || memcmp(a->buffer, b->buffer, a->length)) {
+            return 0;
+          }
+          break;
+        case SCHEME_VECTOR:
+        case SCHEME_CONS:
+          if (a->tag == SCHEME_VECTOR && a->nslots != b->nslots) {
+            return 0;
+          }
+          if (++taken > EQUAL_CYCLE_CHECK && taken % EQUAL_CYCLE_STRIDE == 0 && !first_visit(a, b)) {
+            break;
+          }
+          if (top == cap) {
+            cap = cap ? cap * 2 : 64;
+            if (!(pending = realloc(pending, cap * sizeof(*pending)))) {
+              err(1, "failed to grow equal? stack");
+            }
+          }
+          pending[top].a = a;
+          pending[top].b = b;
+          pending[top++].next = 0;
+          break;
+        default:
+          return 0;
+      }
+    }
+
+    /* the next pair of objects to compare, or done */
+    for (;;) {
+      if (!top) {
+        return 1;
+      }
+      scm_object *pa = pending[top - 1].a, *pb = pending[top - 1].b;
+      if (pa->tag == SCHEME_CONS) {
+        if (pending[top - 1].next++ == 0) {
+          a = CAR(pa);
+          b = CAR(pb);
+        } else {
+          top--;
+          a = CDR(pa);
+          b = CDR(pb);
+        }
         break;
-      case SCHEME_CHARACTER:
-        printf("%c", CAR(args)->char_value);
+      }
+      size_t i = pending[top - 1].next++;
+      if (i < pa->nslots) {
+        a = pa->slots[i];
+        b = pb->slots[i];
         break;
-      default: scm_write(CAR(args));
+      }
+      top--;
     }
-    args = CDR(args);
-    n++;
   }
-  return new_integer(n);
-}
-
-scm_object *pscm_error(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1);
-  assert(CAR(args)->tag == SCHEME_STRING);
-
-  CAR(args)->buffer[CAR(args)->length] = 0;
-  errx(1, "%s", CAR(args)->buffer);
-}
-
-scm_object *pscm_equal(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2);
-
-  scm_object *a = CAR(args), *b = CADR(args);
-
-  if (a->tag != b->tag) return scm_f;
-  switch (a->tag) {
-    case SCHEME_INTEGER:
-      return SCM_BOOL(a->integer_value == b->integer_value);
-    case SCHEME_TRUE: return scm_t;
-    case SCHEME_FALSE: return scm_t;
-    case SCHEME_NIL: return scm_t;
-    case SCHEME_CHARACTER:
-      return SCM_BOOL(a->char_value == b->char_value);
-    case SCHEME_STRING:
-      if (a->length != b->length)
-        return scm_f;
-      return SCM_BOOL(!strncmp(a->buffer, b->buffer, a->length));
-    case SCHEME_CONS:
-      if (pscm_equal(cons(CAR(a), CAR(b)), env) != scm_t)
-        return scm_f;
-      return pscm_equal(cons(CDR(a), CDR(b)), env);
-    default: return SCM_BOOL(a == b);
+}
+
+int scm_equal(scm_object *a, scm_object *b) {
+  int equal = equal_walk(a, b);
+  if (seen) {
+    free(seen);
+    seen = NULL;
+    seen_cap = seen_count = 0;
   }
+  return equal;
+}
+
+/* (eq? a b) is identity; fixnums and characters are immediates, so equal ones are eq? */
+scm_object *pscm_eq(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(argv[0] == argv[1]);
+}
+
+scm_object *pscm_eqv(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(scm_eqv(argv[0], argv[1]));
+}
+
+scm_object *pscm_equal(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(scm_equal(argv[0], argv[1]));
 }
 
-scm_object *pscm_string_ref(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2);
-  assert(CAR(args)->tag == SCHEME_STRING);
-  assert(CADR(args)->tag == SCHEME_INTEGER);
+scm_object *pscm_string_ref(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_STRING);
+  assert(TAG(argv[1]) == SCHEME_INTEGER);
 
-  scm_object *str = CAR(args);
-  size_t idx = CADR(args)->integer_value;
+  scm_object *str = argv[0];
+  size_t idx = INT_VALUE(argv[1]);
 
   if (idx > str->length) {
     errx(1, "string-ref: index %zu out of bounds", idx);
@@ -226,203 +375,230 @@ scm_object *pscm_string_ref(scm_object *args, UNUSED scm_object **env) {
   return new_char(str->buffer[idx]);
 }
 
-scm_object *pscm_string_set(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 3);
-  assert(CAR(args)->tag == SCHEME_STRING);
-  assert(CADR(args)->tag == SCHEME_INTEGER);
-  assert(CADDR(args)->tag == SCHEME_CHARACTER);
+scm_object *pscm_string_set(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_STRING);
+  assert(TAG(argv[1]) == SCHEME_INTEGER);
+  assert(TAG(argv[2]) == SCHEME_CHARACTER);
 
-  scm_object *str = CAR(args), *chr = CADDR(args);
-  size_t idx = CADR(args)->integer_value;
+  scm_object *str = argv[0], *chr = argv[2];
+  size_t idx = INT_VALUE(argv[1]);
 
   if (idx > str->length) {
     errx(1, "string-set!: index %zu out of bounds", idx);
   }
 
-  str->buffer[idx] = chr->char_value;
+  str->buffer[idx] = CHAR_VALUE(chr);
   return scm_t;
 }
 
-scm_object *pscm_string_len(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1);
-  assert(CAR(args)->tag == SCHEME_STRING);
+scm_object *pscm_string_len(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_STRING);
 
-  return new_integer(CAR(args)->length);
+  return new_integer(argv[0]->length);
 }
 
-scm_object *pscm_env(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 0);
-  return *env;
+static size_t vector_index(scm_object *v, scm_object *i, const char *who) {
+  if (TAG(v) != SCHEME_VECTOR) {
+    errx(1, "%s: expected vector, got %s", who, tag_str(TAG(v)));
+  }
+  if (TAG(i) != SCHEME_INTEGER || INT_VALUE(i) < 0 || (size_t) INT_VALUE(i) >= v->nslots) {
+    errx(1, "%s: index out of bounds", who);
+  }
+  return INT_VALUE(i);
 }
 
-scm_object *pscm_eval(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2);
+scm_object *pscm_make_vector(int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_INTEGER || INT_VALUE(argv[0]) < 0) {
+    errx(1, "make-vector: bad length");
+  }
+  return new_vector(INT_VALUE(argv[0]), argc == 2 ? argv[1] : scm_f);
+}
 
-  return eval(CAR(args), &CADR(args));
+scm_object *pscm_vector(int argc, scm_object **argv) {
+  scm_object *v = new_vector(argc, scm_nil);
+  memcpy(v->slots, argv, argc * sizeof(*argv));
+  return v;
 }
 
-scm_object *pscm_gensym(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 0);
-  static int gensym_counter = 0;
+scm_object *pscm_vector_ref(UNUSED int argc, scm_object **argv) {
+  return argv[0]->slots[vector_index(argv[0], argv[1], "vector-ref")];
+}
 
-  char buf[128];
-  if (!sprintf(buf, "#%d", gensym_counter++))
-    err(1, "failed to print symbol %d", gensym_counter);
+scm_object *pscm_vector_set(UNUSED int argc, scm_object **argv) {
+  argv[0]->slots[vector_index(argv[0], argv[1], "vector-set!")] = argv[2];
+  return scm_t;
+}
 
-  return make_symbol(buf);
+scm_object *pscm_vector_len(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_VECTOR);
+
+  return new_integer(argv[0]->nslots);
 }
 
-scm_object *pscm_read_char(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 0 || scm_len(args) == 1);
+scm_object *pscm_vector_to_list(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_VECTOR);
 
-  if (scm_len(args) == 1 && CAR(args)->tag == SCHEME_INTEGER) {
-    char buf;
-    switch (read(CAR(args)->integer_value, &buf, 1)) {
-      case 0:
-        return scm_nil;
-      case 1:
-        return new_char(buf);
-      default: return scm_f;
-    }
-  } else {
-    int ch = getc(scheme_input);
-    if (ch == EOF) {
-      return scm_nil;
-    } else {
-      return new_char((char) ch);
-    }
+  scm_object *list = scm_nil;
+  for (size_t i = argv[0]->nslots; i-- > 0;) {
+    list = cons(argv[0]->slots[i], list);
   }
+  return list;
 }
 
-scm_object *pscm_write_char(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1 || scm_len(args) == 2);
-  assert(CAR(args)->tag == SCHEME_CHARACTER);
-
-  if (scm_len(args) == 2 && CADR(args)->tag == SCHEME_INTEGER) {
-    char buf = CAR(args)->char_value;
-    if (write(CADR(args)->integer_value, &buf, 1) != 1) {
-      return scm_f;
-    }
-    return scm_t;
-  } else {
-    if (!putc((int) CAR(args)->char_value, stdout)) {
-      return scm_f;
-    }
-    return scm_t;
+scm_object *pscm_list_to_vector(UNUSED int argc, scm_object **argv) {
+  scm_object *list = argv[0], *v = new_vector(scm_len(list), scm_nil);
+  for (size_t i = 0; list != scm_nil; i++, list = CDR(list)) {
+    v->slots[i] = CAR(list);
   }
+  return v;
 }
 
-scm_object *pscm_open(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 2 && CAR(args)->tag == SCHEME_STRING && CADR(args)->tag == SCHEME_CHARACTER);
-  int fd;
-  switch (CADR(args)->char_value) {
-    case 'r':
-      if ((fd = open(CAR(args)->buffer, O_RDONLY)) == -1) {
-        return scm_f;
-      }
-      return new_integer(fd);
-    case 'w':
-      if ((fd = open(CAR(args)->buffer, O_WRONLY | O_CREAT, 0644)) == -1) {
-        return scm_f;
-      }
-      return new_integer(fd);
-    case '+':
-      if ((fd = open(CAR(args)->buffer, O_RDWR | O_CREAT, 0644)) == -1) {
-        return scm_f;
-      }
-      return new_integer(fd);
-    default:
-      return scm_f;
+scm_object *pscm_vector_fill(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_VECTOR);
+
+  for (size_t i = 0; i < argv[0]->nslots; i++) {
+    argv[0]->slots[i] = argv[1];
   }
+  return scm_t;
 }
 
-scm_object *pscm_close(scm_object *args, UNUSED scm_object **env) {
-  assert(scm_len(args) == 1);
-  close(CAR(args)->integer_value);
+/* globals live in their symbols, so the top-level environment is an empty frame */
+scm_object *pscm_env(UNUSED int argc, UNUSED scm_object **argv) {
+  return scm_nil;
+}
+
+scm_object *pscm_eval(UNUSED int argc, scm_object **argv) {
+  return execute(analyze(expand(argv[0])));
+}
+
+scm_object *pscm_expand(UNUSED int argc, scm_object **argv) {
+  return expand(argv[0]);
+}
+
+scm_object *pscm_push_macro(UNUSED int argc, scm_object **argv) {
+  define_macro(argv[0], argv[1]);
   return scm_t;
 }
 
-void scm_init() {
-  scm_t = new(SCHEME_TRUE);
-  scm_f = new(SCHEME_FALSE);
-  scm_nil = new(SCHEME_NIL);
-  symbol_table = new(SCHEME_NIL);
-  environment = new(SCHEME_NIL);
+/* (apply f a b ... rest): the last argument is a list of further arguments */
+scm_object *pscm_apply(int argc, scm_object **argv) {
+  scm_object *rest = argv[argc - 1];
+  int n = argc - 2 + scm_len(rest), i = 0;
+  scm_object *args[n > 0 ? n : 1];
 
+  for (; i < argc - 2; i++) {
+    args[i] = argv[i + 1];
+  }
+  for (; rest != scm_nil; rest = CDR(rest)) {
+    args[i++] = CAR(rest);
+  }
+
+  return scm_apply(argv[0], n, args);
+}
+
+scm_object *pscm_gensym(UNUSED int argc, UNUSED scm_object **argv) {
+  static int gensym_counter = 0;
+
+  char buf[128];
+  if (!sprintf(buf, "#%d", gensym_counter++))
+    err(1, "failed to print symbol %d", gensym_counter);
+
+  return new_symbol(buf);
+}
+
+/* the symbols the reader and evaluator refer to directly */
+void intern_syntax(void) {
   quote_sym = make_symbol("quote");
   define_sym = make_symbol("define");
   lambda_sym = make_symbol("lambda");
   if_sym = make_symbol("if");
-  expand_sym = make_symbol("expand");
+  set_sym = make_symbol("set!");
   eof_sym = make_symbol("EOF");
   quasiquote_sym = make_symbol("quasiquote");
   unquote_sym = make_symbol("unquote");
-
-  add_procedure("cons", pscm_cons);
-  add_procedure("car", pscm_car);
-  add_procedure("cdr", pscm_cdr);
-  add_procedure("set-car!", pscm_setcar);
-  add_procedure("set-cdr!", pscm_setcdr);
-  add_procedure("list", pscm_list);
-
-  add_procedure("eq?", pscm_equal);
-
-  add_procedure("pair?", pscm_is_cons);
-  add_procedure("null?", pscm_is_null);
-  add_procedure("bool?", pscm_is_bool);
-  add_procedure("string?", pscm_is_string);
-  add_procedure("char?", pscm_is_char);
-  add_procedure("procedure?", pscm_is_procedure);
-  add_procedure("function?", pscm_is_function);
-  add_procedure("integer?", pscm_is_integer);
-  add_procedure("symbol?", pscm_is_symbol);
-
-  add_procedure("+", pscm_op_plus);
-  add_procedure("-", pscm_op_minus);
-  add_procedure("*", pscm_op_times);
-  add_procedure("/", pscm_op_over);
-  add_procedure("%", pscm_op_rem);
-
-  add_procedure("<", pscm_cmp_lt);
-  add_procedure(">", pscm_cmp_gt);
-  add_procedure("<=", pscm_cmp_lte);
-  add_procedure(">=", pscm_cmp_gte);
-
-  add_procedure("string-ref", pscm_string_ref);
-  add_procedure("string-len", pscm_string_len);
-  add_procedure("string-set!", pscm_string_set);
-
-  add_procedure("open-file", pscm_open);
-  add_procedure("close-file", pscm_close);
-  add_procedure("read-char", pscm_read_char);
-  add_procedure("write-char", pscm_write_char);
-
-  add_procedure("gensym", pscm_gensym);
-  add_procedure("expand", pscm_id);
-  add_procedure("load", pscm_load);
-  add_procedure("write", pscm_write);
-  add_procedure("eval", pscm_eval);
-  add_procedure("environment", pscm_env);
-  add_procedure("error", pscm_error);
-}
-
-scm_object *zip_eval(scm_object *names, scm_object *args, scm_object **env) {
-  scm_object *result = scm_nil;
-  while (names->tag != SCHEME_NIL && args->tag != SCHEME_NIL) {
-    scm_object *arg = eval(CAR(args), env);
-    result = cons(cons(CAR(names), arg), result);
-    names = CDR(names), args = CDR(args);
-  }
-  return result;
+  begin_sym = make_symbol("begin");
+  let_sym = make_symbol("let");
+  letrec_sym = make_symbol("letrec");
+  cond_sym = make_symbol("cond");
+  case_sym = make_symbol("case");
+  else_sym = make_symbol("else");
+  arrow_sym = make_symbol("=>");
 }
 
-scm_object *append(scm_object *a, scm_object *b) {
-  scm_object *result = b;
-  while (a->tag != SCHEME_NIL) {
-    result = cons(CAR(a), result);
-    a = CDR(a);
+void scm_init() {
+  scm_object **roots[] = {
+    &quote_sym, &define_sym, &lambda_sym, &if_sym, &set_sym, &eof_sym, &quasiquote_sym, &unquote_sym,
+    &begin_sym, &let_sym, &letrec_sym, &cond_sym, &case_sym, &else_sym, &arrow_sym
+  };
+  for (size_t i = 0; i < sizeof(roots) / sizeof(*roots); i++) {
+    gc_root(roots[i]);
   }
-  return result;
+  intern_syntax();
+
+  add_procedure("cons", pscm_cons, 2, 2)->proc_op = PRIM_CONS;
+  add_procedure("car", pscm_car, 1, 1)->proc_op = PRIM_CAR;
+  add_procedure("cdr", pscm_cdr, 1, 1)->proc_op = PRIM_CDR;
+  add_procedure("set-car!", pscm_setcar, 2, 2);
+  add_procedure("set-cdr!", pscm_setcdr, 2, 2);
+  add_procedure("list", pscm_list, 0, ARITY_ANY);
+
+  add_procedure("eq?", pscm_eq, 2, 2)->proc_op = PRIM_EQ;
+  add_procedure("eqv?", pscm_eqv, 2, 2)->proc_op = PRIM_EQV;
+  add_procedure("equal?", pscm_equal, 2, 2);
+
+  add_procedure("pair?", pscm_is_cons, 1, 1)->proc_op = PRIM_PAIR;
+  add_procedure("null?", pscm_is_null, 1, 1)->proc_op = PRIM_NULL;
+  add_procedure("bool?", pscm_is_bool, 1, 1);
+  add_procedure("string?", pscm_is_string, 1, 1);
+  add_procedure("char?", pscm_is_char, 1, 1);
+  add_procedure("procedure?", pscm_is_procedure, 1, 1);
+  add_procedure("function?", pscm_is_function, 1, 1);
+  add_procedure("integer?", pscm_is_integer, 1, 1);
+  add_procedure("symbol?", pscm_is_symbol, 1, 1);
+
+  add_procedure("+", pscm_op_plus, 0, ARITY_ANY)->proc_op = PRIM_ADD;
+  add_procedure("-", pscm_op_minus, 1, ARITY_ANY)->proc_op = PRIM_SUB;
+  add_procedure("*", pscm_op_times, 0, ARITY_ANY);
+  add_procedure("/", pscm_op_over, 2, 2);
+  add_procedure("%", pscm_op_rem, 2, 2);
+
+  add_procedure("<", pscm_cmp_lt, 2, 2)->proc_op = PRIM_LT;
+  add_procedure(">", pscm_cmp_gt, 2, 2);
+  add_procedure("<=", pscm_cmp_lte, 2, 2);
+  add_procedure(">=", pscm_cmp_gte, 2, 2);
+
+  add_procedure("string-ref", pscm_string_ref, 2, 2);
+  add_procedure("string-len", pscm_string_len, 1, 1);
+  add_procedure("string-set!", pscm_string_set, 3, 3);
+
+  add_procedure("make-vector", pscm_make_vector, 1, 2);
+  add_procedure("vector", pscm_vector, 0, ARITY_ANY);
+  add_procedure("vector?", pscm_is_vector, 1, 1);
+  add_procedure("vector-ref", pscm_vector_ref, 2, 2);
+  add_procedure("vector-set!", pscm_vector_set, 3, 3);
+  add_procedure("vector-length", pscm_vector_len, 1, 1);
+  add_procedure("vector->list", pscm_vector_to_list, 1, 1);
+  add_procedure("list->vector", pscm_list_to_vector, 1, 1);
+  add_procedure("vector-fill!", pscm_vector_fill, 2, 2);
+
+  add_procedure("gensym", pscm_gensym, 0, 0);
+  add_procedure("expand", pscm_expand, 1, 1);
+  add_procedure("push-macro!", pscm_push_macro, 2, 2);
+  add_procedure("apply", pscm_apply, 2, ARITY_ANY);
+  add_procedure("call/cc", pscm_callcc, 1, 1);
+  add_procedure("call-with-current-continuation", pscm_callcc, 1, 1);
+  add_procedure("load", pscm_load, 1, 1);
+  add_procedure("write", pscm_write, 0, ARITY_ANY);
+  add_procedure("eval", pscm_eval, 1, 2);
+  add_procedure("environment", pscm_env, 0, 0);
+  add_procedure("error", pscm_error, 1, 1);
+
+  numvec_init();
+  hashtab_init();
+  port_init();
+  printer_init();
+  profile_init();
+  stats_init();
 }
 
 // implementation due to nortti (@JuEeHa) and vi
@@ -430,7 +606,7 @@ scm_object *append(scm_object *a, scm_object *b) {
 scm_object *map_eval(scm_object *args, scm_object **env) {
   scm_object *head = scm_nil, **tail_ptr = &head;
 
-  while (args->tag != SCHEME_NIL) {
+  while (args != scm_nil) {
     scm_object *current = cons(eval(CAR(args), env), scm_nil);
     *tail_ptr = current;
     tail_ptr = &CDR(current);
@@ -439,94 +615,3 @@ scm_object *map_eval(scm_object *args, scm_object **env) {
 
   return head;
 }
-
-int scm_write(scm_object *obj) {
-  switch (obj->tag) {
-    case SCHEME_INTEGER:
-      printf("%d", obj->integer_value);
-      break;
-    case SCHEME_TRUE:
-      printf("#t");
-      break;
-    case SCHEME_FALSE:
-      printf("#f");
-      break;
-    case SCHEME_NIL:
-      printf("()");
-      break;
-    case SCHEME_CHARACTER:
-      printf("#\\");
-      switch (obj->char_value) {
-        case '\n':
-          printf("newline"); break;
-        case '\t':
-          printf("tab"); break;
-        case ' ':
-          printf("space"); break;
-        default:
-          printf("%c", obj->char_value); break;
-      }
-      break;
-    case SCHEME_STRING:
-      putchar('"');
-      char c;
-      for (size_t i = 0; i < obj->length; i++) {
-        switch (c = obj->buffer[i]) {
-          case '\n':
-            printf("\\n");
-            break;
-          case '\t':
-            printf("\\t");
-            break;
-          case '"':
-            printf("\\\"");
-            break;
-          case '\\':
-            printf("\\\\");
-            break;
-          default:
-            putchar(c);
-        }
-      }
-      putchar('"');
-      break;
-    case SCHEME_CONS:
-      putchar('(');
-      scm_object *car = CAR(obj), *cdr = CDR(obj);
-
-print_pair:
-      scm_write(car);
-      if (cdr->tag == SCHEME_CONS) {
-        putchar(' ');
-        obj = cdr;
-        car = CAR(obj);
-        cdr = CDR(obj);
-        goto print_pair;
-      } else if (cdr->tag == SCHEME_NIL) {
-      } else {
-        printf(" . ");
-        scm_write(cdr);
-      }
-      goto end;
-
-end:
-        putchar(')');
-        break;
-    case SCHEME_SYMBOL:
-      printf("%s", obj->sym_value);
-      break;
-    case SCHEME_CLOSURE:
-      printf("#<closure %#.zx>", (size_t) obj);
-      break;
-    case SCHEME_PROC:
-      printf("#<procedure %#.zx>", (size_t) obj->procedure);
-      break;
-    case SCHEME_KNOT:
-      printf("#<knot: ");
-      scm_write(obj->fwd);
-      putchar('>');
-      break;
-  }
-  fflush(stdout);
-  return 0;
-}
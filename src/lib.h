@@ -2,18 +2,58 @@
 #define SCHEME_LIB_H_
 
 #include "scheme.h"
+#include "number.h"
 
-scm_object *zip_eval(scm_object *, scm_object *, scm_object **);
-scm_object *append(scm_object *, scm_object *);
 scm_object *map_eval(scm_object *, scm_object **);
 
-int scm_write(scm_object *);
 int scm_len(scm_object *);
+int scm_eqv(scm_object *, scm_object *);
+int scm_equal(scm_object *, scm_object *);
 
-scm_object *add_procedure(const char *, scm_proc);
+scm_object *add_procedure(const char *, scm_proc, int min, int max);
+
+/*
+ * Runs a core primitive on evaluated arguments without calling through its
+ * procedure, or returns NULL when this case needs the procedure itself: a
+ * bignum, an argument count or type it would report an error for. Callers
+ * look op up on the procedure they're calling, so a name rebound to
+ * something else is called as usual.
+ */
+static inline scm_object *prim_inline(enum prim_op op, int argc, scm_object **argv) {
+  scm_object *a = argv[0], *b = argv[argc - 1];
+  int pair = !IS_IMMEDIATE(a) && a->tag == SCHEME_CONS;
+  int fixnums = IS_INTEGER(a) && IS_INTEGER(b);
+
+  if (argc == 1) {
+    switch (op) {
+      case PRIM_CAR: return pair ? CAR(a) : NULL;
+      case PRIM_CDR: return pair ? CDR(a) : NULL;
+      case PRIM_NULL: return SCM_BOOL(a == scm_nil);
+      case PRIM_PAIR: return SCM_BOOL(pair);
+      default: return NULL;
+    }
+  }
+  if (argc == 2) {
+    switch (op) {
+      case PRIM_CONS: return cons(a, b);
+      case PRIM_ADD: return fixnums ? num_add(a, b) : NULL;
+      case PRIM_SUB: return fixnums ? num_sub(a, b) : NULL;
+      case PRIM_LT: return fixnums ? SCM_BOOL((intptr_t) a < (intptr_t) b) : NULL;
+      case PRIM_EQ: return SCM_BOOL(a == b);
+      /* only two bignums can be eqv? without being eq? */
+      case PRIM_EQV: return a == b ? scm_t : IS_IMMEDIATE(a) || IS_IMMEDIATE(b) ? scm_f : NULL;
+      default: return NULL;
+    }
+  }
+  return NULL;
+}
+
+const char *procedure_name(scm_proc);
+scm_proc named_procedure(const char *);
 
 
 void scm_init();
-scm_object *pscm_load(scm_object *, scm_object **);
+void intern_syntax(void);
+scm_object *pscm_load(int, scm_object **);
 
 #endif /* SCHEME_LIB_H_ */
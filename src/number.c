@@ -0,0 +1,359 @@
+#include "number.h"
+#include "stats.h"
+
+#include <inttypes.h>
+
+/*
+ * Bignums are sign and magnitude, the magnitude being 32-bit limbs, least
+ * significant first, with no leading zero limbs. Operations convert their
+ * operands to struct mag, fixnums borrowing a two-limb buffer, and
+ * normalize the result back into a fixnum when it fits.
+ */
+
+struct mag {
+  uint32_t *d;
+  size_t n;
+  int sign;
+  uint32_t buf[2];
+};
+
+static void to_mag(scm_object *o, struct mag *m, const char *who) {
+  if (IS_INTEGER(o)) {
+    intptr_t x = INT_VALUE(o);
+    uint64_t u = x < 0 ? -(uint64_t) x : (uint64_t) x;
+    m->sign = x < 0 ? -1 : 1;
+    m->buf[0] = (uint32_t) u;
+    m->buf[1] = (uint32_t) (u >> 32);
+    m->d = m->buf;
+    m->n = m->buf[1] ? 2 : m->buf[0] ? 1 : 0;
+  } else if (is_integer(o)) {
+    m->d = o->big_limbs;
+    m->n = o->big_len;
+    m->sign = o->big_sign;
+  } else {
+    errx(1, "%s: expected integer, got %s", who, tag_str(TAG(o)));
+  }
+}
+
+static uint32_t *new_limbs(size_t n) {
+  uint32_t *d = calloc(n ? n : 1, sizeof(*d));
+  if (!d) {
+    err(1, "failed to allocate bignum of %zu limbs", n);
+  }
+  return d;
+}
+
+/* takes ownership of d */
+static scm_object *normalize(uint32_t *d, size_t n, int sign) {
+  while (n && !d[n - 1]) {
+    n--;
+  }
+
+  if (n <= 2) {
+    uint64_t u = n == 2 ? (uint64_t) d[1] << 32 | d[0] : n ? d[0] : 0;
+    if (sign > 0 ? u <= (uint64_t) FIXNUM_MAX : u <= (uint64_t) FIXNUM_MAX + 1) {
+      free(d);
+      return new_integer(sign > 0 ? (intptr_t) u : -(intptr_t) u);
+    }
+  }
+
+  scm_object *o = new(SCHEME_BIGNUM);
+  stats.bytes[SCHEME_BIGNUM] += n * sizeof(*d);
+  o->big_limbs = d;
+  o->big_len = n;
+  o->big_sign = sign;
+  return o;
+}
+
+scm_object *make_integer(intptr_t x) {
+  if (x >= FIXNUM_MIN && x <= FIXNUM_MAX) {
+    return new_integer(x);
+  }
+  uint64_t u = x < 0 ? -(uint64_t) x : (uint64_t) x;
+  uint32_t *d = new_limbs(2);
+  d[0] = (uint32_t) u;
+  d[1] = (uint32_t) (u >> 32);
+  return normalize(d, 2, x < 0 ? -1 : 1);
+}
+
+/* 0 if o isn't an integer or doesn't fit in 64 bits */
+int integer_to_int64(scm_object *o, int64_t *out) {
+  if (IS_INTEGER(o)) {
+    *out = INT_VALUE(o);
+    return 1;
+  }
+  if (!is_integer(o) || o->big_len > 2) {
+    return 0;
+  }
+  uint64_t u = (uint64_t) o->big_limbs[1] << 32 | o->big_limbs[0];
+  if (o->big_sign > 0 ? u > (uint64_t) INT64_MAX : u > (uint64_t) INT64_MAX + 1) {
+    return 0;
+  }
+  *out = o->big_sign > 0 ? (int64_t) u : (int64_t) -(u - 1) - 1;
+  return 1;
+}
+
+static int mag_cmp(const struct mag *a, const struct mag *b) {
+  if (a->n != b->n) {
+    return a->n < b->n ? -1 : 1;
+  }
+  for (size_t i = a->n; i-- > 0;) {
+    if (a->d[i] != b->d[i]) {
+      return a->d[i] < b->d[i] ? -1 : 1;
+    }
+  }
+  return 0;
+}
+
+static uint32_t *mag_add(const struct mag *a, const struct mag *b, size_t *n) {
+  if (a->n < b->n) {
+    const struct mag *t = a;
+    a = b;
+    b = t;
+  }
+
+  uint32_t *d = new_limbs(a->n + 1);
+  uint64_t carry = 0;
+  for (size_t i = 0; i < a->n; i++) {
+    carry += (uint64_t) a->d[i] + (i < b->n ? b->d[i] : 0);
+    d[i] = (uint32_t) carry;
+    carry >>= 32;
+  }
+  d[a->n] = (uint32_t) carry;
+  *n = a->n + 1;
+  return d;
+}
+
+/* |a| - |b|, where |a| >= |b| */
+static uint32_t *mag_sub(const struct mag *a, const struct mag *b, size_t *n) {
+  uint32_t *d = new_limbs(a->n);
+  int64_t borrow = 0;
+  for (size_t i = 0; i < a->n; i++) {
+    int64_t x = (int64_t) a->d[i] - (i < b->n ? b->d[i] : 0) - borrow;
+    borrow = x < 0;
+    d[i] = (uint32_t) (x + (borrow ? (int64_t) 1 << 32 : 0));
+  }
+  *n = a->n;
+  return d;
+}
+
+/* a + sign * b */
+static scm_object *add_signed(scm_object *x, scm_object *y, int negate, const char *who) {
+  struct mag a, b;
+  uint32_t *d;
+  size_t n;
+
+  to_mag(x, &a, who);
+  to_mag(y, &b, who);
+  if (negate) {
+    b.sign = -b.sign;
+  }
+
+  if (a.sign == b.sign) {
+    d = mag_add(&a, &b, &n);
+    return normalize(d, n, a.sign);
+  } else if (mag_cmp(&a, &b) >= 0) {
+    d = mag_sub(&a, &b, &n);
+    return normalize(d, n, a.sign);
+  } else {
+    d = mag_sub(&b, &a, &n);
+    return normalize(d, n, b.sign);
+  }
+}
+
+scm_object *big_add(scm_object *a, scm_object *b) {
+  return add_signed(a, b, 0, "+");
+}
+
+scm_object *big_sub(scm_object *a, scm_object *b) {
+  return add_signed(a, b, 1, "-");
+}
+
+scm_object *big_mul(scm_object *x, scm_object *y) {
+  struct mag a, b;
+  to_mag(x, &a, "*");
+  to_mag(y, &b, "*");
+
+  uint32_t *d = new_limbs(a.n + b.n);
+  for (size_t i = 0; i < a.n; i++) {
+    uint64_t carry = 0;
+    for (size_t j = 0; j < b.n; j++) {
+      carry += (uint64_t) a.d[i] * b.d[j] + d[i + j];
+      d[i + j] = (uint32_t) carry;
+      carry >>= 32;
+    }
+    d[i + b.n] = (uint32_t) carry;
+  }
+  return normalize(d, a.n + b.n, a.sign * b.sign);
+}
+
+/* divide a by a single limb in place, returning the remainder */
+static uint32_t mag_divmod_small(uint32_t *d, size_t n, uint32_t divisor) {
+  uint64_t rem = 0;
+  for (size_t i = n; i-- > 0;) {
+    rem = rem << 32 | d[i];
+    d[i] = (uint32_t) (rem / divisor);
+    rem %= divisor;
+  }
+  return (uint32_t) rem;
+}
+
+/* truncating division, as C does it: the remainder takes the dividend's sign */
+static void divmod(scm_object *x, scm_object *y, scm_object **q, scm_object **r, const char *who) {
+  struct mag a, b;
+  to_mag(x, &a, who);
+  to_mag(y, &b, who);
+
+  if (!b.n) {
+    errx(1, "%s: division by zero", who);
+  }
+
+  uint32_t *qd = new_limbs(a.n), *rd = new_limbs(b.n + 1);
+  size_t rn = 0;
+
+  if (b.n == 1) {
+    memcpy(qd, a.d, a.n * sizeof(*qd));
+    rd[0] = mag_divmod_small(qd, a.n, b.d[0]);
+    rn = 1;
+  } else {
+    /* shift-and-subtract, one bit of the quotient at a time */
+    struct mag rem = { rd, 0, 1, { 0, 0 } };
+    for (size_t i = a.n * 32; i-- > 0;) {
+      uint32_t carry = (a.d[i / 32] >> (i % 32)) & 1;
+      for (size_t j = 0; j < rem.n; j++) {
+        uint32_t top = rd[j] >> 31;
+        rd[j] = rd[j] << 1 | carry;
+        carry = top;
+      }
+      if (carry) {
+        rd[rem.n++] = carry;
+      }
+      if (mag_cmp(&rem, &b) >= 0) {
+        size_t n;
+        uint32_t *diff = mag_sub(&rem, &b, &n);
+        memcpy(rd, diff, n * sizeof(*rd));
+        free(diff);
+        while (rem.n && !rd[rem.n - 1]) {
+          rem.n--;
+        }
+        qd[i / 32] |= (uint32_t) 1 << (i % 32);
+      }
+    }
+    rn = rem.n;
+  }
+
+  int qsign = a.sign * b.sign, rsign = a.sign;
+  *q = normalize(qd, a.n, qsign);
+  *r = normalize(rd, rn, rsign);
+}
+
+scm_object *num_quotient(scm_object *a, scm_object *b) {
+  if (IS_INTEGER(a) && IS_INTEGER(b) && b != new_integer(0)) {
+    intptr_t x = INT_VALUE(a), y = INT_VALUE(b);
+    if (!(x == FIXNUM_MIN && y == -1)) {
+      return new_integer(x / y);
+    }
+  }
+  scm_object *q, *r;
+  divmod(a, b, &q, &r, "/");
+  return q;
+}
+
+scm_object *num_remainder(scm_object *a, scm_object *b) {
+  if (IS_INTEGER(a) && IS_INTEGER(b) && b != new_integer(0)) {
+    return new_integer(INT_VALUE(a) % INT_VALUE(b));
+  }
+  scm_object *q, *r;
+  divmod(a, b, &q, &r, "%");
+  return r;
+}
+
+int big_cmp(scm_object *x, scm_object *y) {
+  struct mag a, b;
+  to_mag(x, &a, "compare");
+  to_mag(y, &b, "compare");
+
+  if (a.sign != b.sign) {
+    return a.sign;
+  }
+  return a.sign * mag_cmp(&a, &b);
+}
+
+scm_object *parse_integer(const char *digits, size_t len, int negative) {
+  intptr_t acc = 0;
+  size_t i = 0;
+
+  for (; i < len; i++) {
+    if (__builtin_mul_overflow(acc, 10, &acc) || __builtin_add_overflow(acc, digits[i] - '0', &acc)) {
+      break;
+    }
+  }
+  if (i == len) {
+    return make_integer(negative ? -acc : acc);
+  }
+
+  /* too long for a machine word: accumulate nine digits at a time */
+  size_t cap = len / 9 + 2, n = 0;
+  uint32_t *d = new_limbs(cap);
+  for (i = 0; i < len;) {
+    uint32_t chunk = 0, scale = 1;
+    for (size_t j = 0; j < 9 && i < len; j++, i++) {
+      chunk = chunk * 10 + (digits[i] - '0');
+      scale *= 10;
+    }
+    uint64_t carry = chunk;
+    for (size_t k = 0; k < n; k++) {
+      carry += (uint64_t) d[k] * scale;
+      d[k] = (uint32_t) carry;
+      carry >>= 32;
+    }
+    if (carry) {
+      d[n++] = (uint32_t) carry;
+    }
+  }
+  return normalize(d, n, negative ? -1 : 1);
+}
+
+/* the caller frees the result */
+char *integer_to_string(scm_object *o) {
+  char *s;
+
+  if (IS_INTEGER(o)) {
+    if (!(s = malloc(24))) {
+      err(1, "failed to print integer");
+    }
+    snprintf(s, 24, "%" PRIdPTR, INT_VALUE(o));
+    return s;
+  }
+
+  /* peel off nine decimal digits at a time, least significant first */
+  size_t n = o->big_len, cap = n * 10 + 2, len = 0;
+  uint32_t *d = new_limbs(n);
+  memcpy(d, o->big_limbs, n * sizeof(*d));
+  if (!(s = malloc(cap))) {
+    err(1, "failed to print bignum");
+  }
+
+  while (n) {
+    uint32_t chunk = mag_divmod_small(d, n, 1000000000);
+    while (n && !d[n - 1]) {
+      n--;
+    }
+    for (int j = 0; j < 9 && (n || chunk); j++) {
+      s[len++] = '0' + chunk % 10;
+      chunk /= 10;
+    }
+  }
+  if (o->big_sign < 0) {
+    s[len++] = '-';
+  }
+  s[len] = '\0';
+  free(d);
+
+  for (size_t i = 0; i < len / 2; i++) {
+    char c = s[i];
+    s[i] = s[len - 1 - i];
+    s[len - 1 - i] = c;
+  }
+  return s;
+}
@@ -0,0 +1,64 @@
+#ifndef NUMBER_H_
+#define NUMBER_H_
+
+#include "scheme.h"
+
+/*
+ * Integers are 63-bit fixnums while they fit and bignums once they don't;
+ * every operation returns a fixnum when the result fits, so a bignum never
+ * equals a fixnum. The fast paths below work on the tagged words directly:
+ * with a = 2x+1 and b = 2y+1, a + (b-1) = 2(x+y)+1, and the processor's
+ * overflow flag is exactly fixnum overflow.
+ */
+#define FIXNUM_MAX (INTPTR_MAX >> 1)
+#define FIXNUM_MIN (INTPTR_MIN >> 1)
+
+static inline int is_integer(scm_object *o) {
+  return IS_INTEGER(o) || (!IS_IMMEDIATE(o) && o->tag == SCHEME_BIGNUM);
+}
+
+scm_object *make_integer(intptr_t);
+int integer_to_int64(scm_object *, int64_t *);
+scm_object *parse_integer(const char *digits, size_t len, int negative);
+char *integer_to_string(scm_object *);
+
+scm_object *big_add(scm_object *, scm_object *);
+scm_object *big_sub(scm_object *, scm_object *);
+scm_object *big_mul(scm_object *, scm_object *);
+scm_object *num_quotient(scm_object *, scm_object *);
+scm_object *num_remainder(scm_object *, scm_object *);
+int big_cmp(scm_object *, scm_object *);
+
+static inline scm_object *num_add(scm_object *a, scm_object *b) {
+  intptr_t r;
+  if (IS_INTEGER(a) && IS_INTEGER(b) && !__builtin_add_overflow((intptr_t) a, (intptr_t) b - 1, &r)) {
+    return (scm_object *) r;
+  }
+  return big_add(a, b);
+}
+
+static inline scm_object *num_sub(scm_object *a, scm_object *b) {
+  intptr_t r;
+  if (IS_INTEGER(a) && IS_INTEGER(b) && !__builtin_sub_overflow((intptr_t) a, (intptr_t) b - 1, &r)) {
+    return (scm_object *) r;
+  }
+  return big_sub(a, b);
+}
+
+static inline scm_object *num_mul(scm_object *a, scm_object *b) {
+  intptr_t r;
+  if (IS_INTEGER(a) && IS_INTEGER(b) && !__builtin_mul_overflow(INT_VALUE(a), (intptr_t) b - 1, &r)) {
+    return (scm_object *) (r | 1);
+  }
+  return big_mul(a, b);
+}
+
+/* <0, 0 or >0 as a is less than, equal to or greater than b */
+static inline int num_cmp(scm_object *a, scm_object *b) {
+  if (IS_INTEGER(a) && IS_INTEGER(b)) {
+    return ((intptr_t) a > (intptr_t) b) - ((intptr_t) a < (intptr_t) b);
+  }
+  return big_cmp(a, b);
+}
+
+#endif /* NUMBER_H_ */
@@ -0,0 +1,342 @@
+#include "numvec.h"
+#include "lib.h"
+#include "number.h"
+#include "stats.h"
+
+/*
+ * Homogeneous integer vectors, s32 and s64, with the elements stored
+ * unboxed in a malloc'd buffer. The bulk operations are plain loops over
+ * restrict pointers, written so the compiler can vectorize them: element-
+ * wise add and mul wrap around like unsigned C arithmetic, while the
+ * reductions are exact and return a bignum when they need to.
+ */
+
+#define K(T, CTYPE, UTYPE) \
+  static void T ## _add(CTYPE *restrict d, const CTYPE *restrict a, const CTYPE *restrict b, size_t n) { \
+    for (size_t i = 0; i < n; i++) { \
+      d[i] = (CTYPE) ((UTYPE) a[i] + (UTYPE) b[i]); \
+    } \
+  } \
+  static void T ## _mul(CTYPE *restrict d, const CTYPE *restrict a, const CTYPE *restrict b, size_t n) { \
+    for (size_t i = 0; i < n; i++) { \
+      d[i] = (CTYPE) ((UTYPE) a[i] * (UTYPE) b[i]); \
+    } \
+  } \
+  static void T ## _fill(CTYPE *restrict d, CTYPE x, size_t n) { \
+    for (size_t i = 0; i < n; i++) { \
+      d[i] = x; \
+    } \
+  } \
+  static CTYPE T ## _min(const CTYPE *restrict a, size_t n) { \
+    CTYPE m = a[0]; \
+    for (size_t i = 1; i < n; i++) { \
+      m = a[i] < m ? a[i] : m; \
+    } \
+    return m; \
+  } \
+  static CTYPE T ## _max(const CTYPE *restrict a, size_t n) { \
+    CTYPE m = a[0]; \
+    for (size_t i = 1; i < n; i++) { \
+      m = a[i] > m ? a[i] : m; \
+    } \
+    return m; \
+  }
+
+K(s32, int32_t, uint32_t)
+K(s64, int64_t, uint64_t)
+
+#undef K
+
+/* an s32 sum can't overflow 64 bits below 2^32 elements */
+static int64_t s32_sum(const int32_t *restrict a, size_t n) {
+  int64_t sum = 0;
+  for (size_t i = 0; i < n; i++) {
+    sum += a[i];
+  }
+  return sum;
+}
+
+/* s64 sums and dot products spill into a bignum whenever 64 bits overflow */
+static scm_object *s64_sum(const int64_t *a, size_t n) {
+  scm_object *big = new_integer(0);
+  int64_t acc = 0, next;
+  for (size_t i = 0; i < n; i++) {
+    if (__builtin_add_overflow(acc, a[i], &next)) {
+      big = num_add(big, make_integer(acc));
+      next = a[i];
+    }
+    acc = next;
+  }
+  return num_add(big, make_integer(acc));
+}
+
+static scm_object *dot(scm_object *x, scm_object *y) {
+  scm_object *big = new_integer(0);
+  int64_t acc = 0, next, p;
+  for (size_t i = 0; i < x->vec_len; i++) {
+    int64_t a, b;
+    if (x->tag == SCHEME_S32VECTOR) {
+      a = ((int32_t *) x->vec_data)[i];
+      b = ((int32_t *) y->vec_data)[i];
+    } else {
+      a = ((int64_t *) x->vec_data)[i];
+      b = ((int64_t *) y->vec_data)[i];
+    }
+    if (__builtin_mul_overflow(a, b, &p)) {
+      big = num_add(big, num_mul(make_integer(a), make_integer(b)));
+    } else if (__builtin_add_overflow(acc, p, &next)) {
+      big = num_add(big, make_integer(acc));
+      acc = p;
+    } else {
+      acc = next;
+    }
+  }
+  return num_add(big, make_integer(acc));
+}
+
+static const char *type_name(enum obj_tag type) {
+  return type == SCHEME_S32VECTOR ? "s32vector" : "s64vector";
+}
+
+static size_t elem_size(enum obj_tag type) {
+  return type == SCHEME_S32VECTOR ? sizeof(int32_t) : sizeof(int64_t);
+}
+
+static scm_object *new_vec(enum obj_tag type, size_t n) {
+  scm_object *v = new(type);
+  if (!(v->vec_data = calloc(n ? n : 1, elem_size(type)))) {
+    err(1, "failed to allocate %s of %zu elements", type_name(type), n);
+  }
+  v->vec_len = n;
+  stats.bytes[type] += n * elem_size(type);
+  return v;
+}
+
+static scm_object *check_vec(enum obj_tag type, scm_object *v) {
+  if (TAG(v) != type) {
+    errx(1, "expected %s, got %s", type_name(type), tag_str(TAG(v)));
+  }
+  return v;
+}
+
+static int64_t check_elem(enum obj_tag type, scm_object *x) {
+  int64_t e;
+  if (!integer_to_int64(x, &e) || (type == SCHEME_S32VECTOR && (e < INT32_MIN || e > INT32_MAX))) {
+    errx(1, "%s element out of range", type_name(type));
+  }
+  return e;
+}
+
+static size_t check_index(scm_object *v, scm_object *i) {
+  if (TAG(i) != SCHEME_INTEGER || INT_VALUE(i) < 0 || (size_t) INT_VALUE(i) >= v->vec_len) {
+    errx(1, "%s index out of bounds", type_name(v->tag));
+  }
+  return INT_VALUE(i);
+}
+
+static scm_object *elem(scm_object *v, size_t i) {
+  return make_integer(v->tag == SCHEME_S32VECTOR ? ((int32_t *) v->vec_data)[i] : ((int64_t *) v->vec_data)[i]);
+}
+
+static void set_elem(scm_object *v, size_t i, int64_t e) {
+  if (v->tag == SCHEME_S32VECTOR) {
+    ((int32_t *) v->vec_data)[i] = (int32_t) e;
+  } else {
+    ((int64_t *) v->vec_data)[i] = e;
+  }
+}
+
+static void fill(scm_object *v, int64_t e) {
+  if (v->tag == SCHEME_S32VECTOR) {
+    s32_fill(v->vec_data, (int32_t) e, v->vec_len);
+  } else {
+    s64_fill(v->vec_data, e, v->vec_len);
+  }
+}
+
+/* primitives, each taking the vector type it was registered for */
+
+static scm_object *make(enum obj_tag type, int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_INTEGER || INT_VALUE(argv[0]) < 0) {
+    errx(1, "make-%s: bad length", type_name(type));
+  }
+  scm_object *v = new_vec(type, INT_VALUE(argv[0]));
+  if (argc == 2) {
+    fill(v, check_elem(type, argv[1]));
+  }
+  return v;
+}
+
+static scm_object *is_vec(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(TAG(argv[0]) == type);
+}
+
+static scm_object *from_args(enum obj_tag type, int argc, scm_object **argv) {
+  scm_object *v = new_vec(type, argc);
+  for (int i = 0; i < argc; i++) {
+    set_elem(v, i, check_elem(type, argv[i]));
+  }
+  return v;
+}
+
+static scm_object *length(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  return new_integer(check_vec(type, argv[0])->vec_len);
+}
+
+static scm_object *ref(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]);
+  return elem(v, check_index(v, argv[1]));
+}
+
+static scm_object *set(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]);
+  set_elem(v, check_index(v, argv[1]), check_elem(type, argv[2]));
+  return scm_t;
+}
+
+static scm_object *to_list(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]), *list = scm_nil;
+  for (size_t i = v->vec_len; i-- > 0;) {
+    list = cons(elem(v, i), list);
+  }
+  return list;
+}
+
+static scm_object *from_list(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *list = argv[0], *v = new_vec(type, scm_len(list));
+  for (size_t i = 0; list != scm_nil; i++, list = CDR(list)) {
+    set_elem(v, i, check_elem(type, CAR(list)));
+  }
+  return v;
+}
+
+/* the reader's #s32(...) and #s64(...) */
+scm_object *list_to_numvec(enum obj_tag type, scm_object *list) {
+  return from_list(type, 1, &list);
+}
+
+static scm_object *copy(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]), *c = new_vec(type, v->vec_len);
+  memcpy(c->vec_data, v->vec_data, v->vec_len * elem_size(type));
+  return c;
+}
+
+static scm_object *fill_bang(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  fill(check_vec(type, argv[0]), check_elem(type, argv[1]));
+  return scm_t;
+}
+
+static void check_pair(enum obj_tag type, scm_object **argv) {
+  check_vec(type, argv[0]);
+  check_vec(type, argv[1]);
+  if (argv[0]->vec_len != argv[1]->vec_len) {
+    errx(1, "%s lengths differ: %zu and %zu", type_name(type), argv[0]->vec_len, argv[1]->vec_len);
+  }
+}
+
+static scm_object *add(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  check_pair(type, argv);
+  scm_object *d = new_vec(type, argv[0]->vec_len);
+  if (type == SCHEME_S32VECTOR) {
+    s32_add(d->vec_data, argv[0]->vec_data, argv[1]->vec_data, d->vec_len);
+  } else {
+    s64_add(d->vec_data, argv[0]->vec_data, argv[1]->vec_data, d->vec_len);
+  }
+  return d;
+}
+
+static scm_object *mul(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  check_pair(type, argv);
+  scm_object *d = new_vec(type, argv[0]->vec_len);
+  if (type == SCHEME_S32VECTOR) {
+    s32_mul(d->vec_data, argv[0]->vec_data, argv[1]->vec_data, d->vec_len);
+  } else {
+    s64_mul(d->vec_data, argv[0]->vec_data, argv[1]->vec_data, d->vec_len);
+  }
+  return d;
+}
+
+static scm_object *dot_product(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  check_pair(type, argv);
+  return dot(argv[0], argv[1]);
+}
+
+static scm_object *sum(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]);
+  if (type == SCHEME_S32VECTOR) {
+    return make_integer(s32_sum(v->vec_data, v->vec_len));
+  }
+  return s64_sum(v->vec_data, v->vec_len);
+}
+
+static scm_object *min(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]);
+  if (!v->vec_len) {
+    errx(1, "%s-min: empty vector", type_name(type));
+  }
+  return make_integer(type == SCHEME_S32VECTOR ? s32_min(v->vec_data, v->vec_len) : s64_min(v->vec_data, v->vec_len));
+}
+
+static scm_object *max(enum obj_tag type, UNUSED int argc, scm_object **argv) {
+  scm_object *v = check_vec(type, argv[0]);
+  if (!v->vec_len) {
+    errx(1, "%s-max: empty vector", type_name(type));
+  }
+  return make_integer(type == SCHEME_S32VECTOR ? s32_max(v->vec_data, v->vec_len) : s64_max(v->vec_data, v->vec_len));
+}
+
+#define W(T, TYPE, FN) \
+  static scm_object *pscm_ ## T ## _ ## FN(int argc, scm_object **argv) { \
+    return FN(TYPE, argc, argv); \
+  }
+
+#define OPS(T, TYPE) \
+  W(T, TYPE, make) W(T, TYPE, is_vec) W(T, TYPE, from_args) W(T, TYPE, length) \
+  W(T, TYPE, ref) W(T, TYPE, set) W(T, TYPE, to_list) W(T, TYPE, from_list) \
+  W(T, TYPE, copy) W(T, TYPE, fill_bang) W(T, TYPE, add) W(T, TYPE, mul) \
+  W(T, TYPE, dot_product) W(T, TYPE, sum) W(T, TYPE, min) W(T, TYPE, max)
+
+OPS(s32, SCHEME_S32VECTOR)
+OPS(s64, SCHEME_S64VECTOR)
+
+#undef OPS
+#undef W
+
+/* names are formats taking the type name, e.g. "make-%s" */
+#define R(NAME, FN, MIN, MAX) \
+  { NAME, pscm_s32_ ## FN, pscm_s64_ ## FN, MIN, MAX }
+
+static const struct {
+  const char *name;
+  scm_proc s32, s64;
+  int min, max;
+} ops[] = {
+  R("make-%s", make, 1, 2),
+  R("%s?", is_vec, 1, 1),
+  R("%s", from_args, 0, ARITY_ANY),
+  R("%s-length", length, 1, 1),
+  R("%s-ref", ref, 2, 2),
+  R("%s-set!", set, 3, 3),
+  R("%s->list", to_list, 1, 1),
+  R("list->%s", from_list, 1, 1),
+  R("%s-copy", copy, 1, 1),
+  R("%s-fill!", fill_bang, 2, 2),
+  R("%s-add", add, 2, 2),
+  R("%s-mul", mul, 2, 2),
+  R("%s-dot", dot_product, 2, 2),
+  R("%s-sum", sum, 1, 1),
+  R("%s-min", min, 1, 1),
+  R("%s-max", max, 1, 1),
+};
+
+#undef R
+
+void numvec_init(void) {
+  char name[64];
+  for (size_t i = 0; i < sizeof(ops) / sizeof(*ops); i++) {
+    snprintf(name, sizeof(name), ops[i].name, "s32vector");
+    add_procedure(name, ops[i].s32, ops[i].min, ops[i].max);
+    snprintf(name, sizeof(name), ops[i].name, "s64vector");
+    add_procedure(name, ops[i].s64, ops[i].min, ops[i].max);
+  }
+}
@@ -0,0 +1,9 @@
+#ifndef NUMVEC_H_
+#define NUMVEC_H_
+
+#include "scheme.h"
+
+void numvec_init(void);
+scm_object *list_to_numvec(enum obj_tag type, scm_object *list);
+
+#endif /* NUMVEC_H_ */
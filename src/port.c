@@ -0,0 +1,413 @@
+#include "port.h"
+#include "lib.h"
+#include "reader.h"
+#include "fasl.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+/*
+ * File ports with their own input and output buffers, so reading and
+ * writing cost a syscall per PORT_BUFSIZE bytes rather than per character.
+ * Open ports are kept on a list so anything still buffered is written out
+ * at exit; a port the collector frees is flushed and closed too.
+ *
+ * Primitives called without a port use stdin and stdout through stdio,
+ * which is buffered already.
+ */
+
+#define PORT_BUFSIZE 8192
+
+struct port {
+  int fd;
+  char *in, *out; /* NULL unless the port reads / writes */
+  size_t in_pos, in_len, out_len;
+  struct port *prev, *next;
+};
+
+static struct port *open_ports;
+
+static char *new_buffer(void) {
+  char *buf = malloc(PORT_BUFSIZE);
+  if (!buf) {
+    err(1, "failed to allocate port buffer");
+  }
+  return buf;
+}
+
+static int write_all(int fd, const char *buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, buf, len);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return 0;
+    }
+    buf += n;
+    len -= n;
+  }
+  return 1;
+}
+
+static int flush(struct port *p) {
+  int ok = write_all(p->fd, p->out, p->out_len);
+  p->out_len = 0;
+  return ok;
+}
+
+/*
+ * Refills an empty input buffer, returning 0 at end of file. A port open
+ * for both shares one file offset, so pending output goes out first.
+ */
+static int fill(struct port *p) {
+  if (p->in_pos < p->in_len) {
+    return 1;
+  }
+  if (p->out && p->out_len && !flush(p)) {
+    return 0;
+  }
+  ssize_t n;
+  while ((n = read(p->fd, p->in, PORT_BUFSIZE)) == -1 && errno == EINTR);
+  if (n <= 0) {
+    return 0;
+  }
+  p->in_pos = 0;
+  p->in_len = n;
+  return 1;
+}
+
+/* drops read-ahead, moving the offset back to where the reader got to */
+static void unread(struct port *p) {
+  if (p->in && p->in_pos < p->in_len) {
+    lseek(p->fd, -(off_t) (p->in_len - p->in_pos), SEEK_CUR);
+    p->in_pos = p->in_len = 0;
+  }
+}
+
+static int put(struct port *p, const char *s, size_t len) {
+  unread(p);
+  if (p->out_len + len > PORT_BUFSIZE && !flush(p)) {
+    return 0;
+  }
+  if (len >= PORT_BUFSIZE) {
+    return write_all(p->fd, s, len);
+  }
+  memcpy(p->out + p->out_len, s, len);
+  p->out_len += len;
+  return 1;
+}
+
+static int close_port(struct port *p) {
+  if (p->fd == -1) {
+    return 1;
+  }
+  int ok = !p->out || flush(p);
+  ok = close(p->fd) == 0 && ok;
+  p->fd = -1;
+  free(p->in);
+  free(p->out);
+  p->in = p->out = NULL;
+
+  if (p->prev) {
+    p->prev->next = p->next;
+  } else {
+    open_ports = p->next;
+  }
+  if (p->next) {
+    p->next->prev = p->prev;
+  }
+  return ok;
+}
+
+/* ports don't survive an image; they come back closed */
+void port_restore(scm_object *o) {
+  if (!(o->port = calloc(1, sizeof(*o->port)))) {
+    err(1, "failed to allocate port");
+  }
+  o->port->fd = -1;
+}
+
+void port_free(scm_object *o) {
+  if (o->port) {
+    close_port(o->port);
+    free(o->port);
+  }
+}
+
+static void flush_all(void) {
+  for (struct port *p = open_ports; p; p = p->next) {
+    if (p->out) {
+      flush(p);
+    }
+  }
+}
+
+/* the port in argv[i], or NULL to use stdio when the argument was left out */
+static struct port *port_arg(int argc, scm_object **argv, int i, int output, const char *who) {
+  if (i >= argc) {
+    return NULL;
+  }
+  if (TAG(argv[i]) != SCHEME_PORT) {
+    errx(1, "%s: expected port, got %s", who, tag_str(TAG(argv[i])));
+  }
+  struct port *p = argv[i]->port;
+  if (p->fd == -1) {
+    errx(1, "%s: port is closed", who);
+  }
+  if (!(output ? p->out : p->in)) {
+    errx(1, "%s: port is not open for %s", who, output ? "writing" : "reading");
+  }
+  return p;
+}
+
+static scm_object *pscm_open(UNUSED int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_STRING && TAG(argv[1]) == SCHEME_CHARACTER);
+  int flags;
+  switch (CHAR_VALUE(argv[1])) {
+    case 'r': flags = O_RDONLY; break;
+    case 'w': flags = O_WRONLY | O_CREAT; break;
+    case '+': flags = O_RDWR | O_CREAT; break;
+    default: return scm_f;
+  }
+  int fd = open(argv[0]->buffer, flags, 0644);
+  if (fd == -1) {
+    return scm_f;
+  }
+
+  struct port *p = calloc(1, sizeof(*p));
+  if (!p) {
+    err(1, "failed to allocate port");
+  }
+  p->fd = fd;
+  p->in = (flags & O_ACCMODE) != O_WRONLY ? new_buffer() : NULL;
+  p->out = (flags & O_ACCMODE) != O_RDONLY ? new_buffer() : NULL;
+  if ((p->next = open_ports)) {
+    open_ports->prev = p;
+  }
+  open_ports = p;
+
+  scm_object *o = new(SCHEME_PORT);
+  o->port = p;
+  return o;
+}
+
+static scm_object *pscm_close(UNUSED int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_PORT) {
+    errx(1, "close-file: expected port, got %s", tag_str(TAG(argv[0])));
+  }
+  return SCM_BOOL(close_port(argv[0]->port));
+}
+
+static scm_object *pscm_is_port(UNUSED int argc, scm_object **argv) {
+  return SCM_BOOL(TAG(argv[0]) == SCHEME_PORT);
+}
+
+static scm_object *pscm_read_char(int argc, scm_object **argv) {
+  struct port *p = port_arg(argc, argv, 0, 0, "read-char");
+  if (!p) {
+    int ch = getc(scheme_input);
+    return ch == EOF ? scm_nil : new_char((char) ch);
+  }
+  return fill(p) ? new_char(p->in[p->in_pos++]) : scm_nil;
+}
+
+static scm_object *pscm_write_char(int argc, scm_object **argv) {
+  assert(TAG(argv[0]) == SCHEME_CHARACTER);
+
+  char c = CHAR_VALUE(argv[0]);
+  struct port *p = port_arg(argc, argv, 1, 1, "write-char");
+  return SCM_BOOL(p ? put(p, &c, 1) : putc(c, stdout) != EOF);
+}
+
+/* a growing string buffer for the readers below */
+struct strbuf {
+  char *data;
+  size_t len, cap;
+};
+
+static void append(struct strbuf *s, const char *data, size_t len) {
+  if (s->len + len + 1 > s->cap) {
+    while (s->len + len + 1 > s->cap) {
+      s->cap = s->cap ? s->cap * 2 : 64;
+    }
+    if (!(s->data = realloc(s->data, s->cap))) {
+      err(1, "failed to grow string buffer");
+    }
+  }
+  memcpy(s->data + s->len, data, len);
+  s->len += len;
+  s->data[s->len] = '\0';
+}
+
+static scm_object *take_string(struct strbuf *s) {
+  if (!s->data) {
+    append(s, "", 0);
+  }
+  return new_string(s->data, s->len);
+}
+
+/* (read-line [port]) drops the newline, and returns () at end of file */
+static scm_object *pscm_read_line(int argc, scm_object **argv) {
+  struct port *p = port_arg(argc, argv, 0, 0, "read-line");
+  struct strbuf line = { 0 };
+
+  if (!p) {
+    ssize_t n = getline(&line.data, &line.cap, scheme_input);
+    if (n == -1) {
+      free(line.data);
+      return scm_nil;
+    }
+    line.len = n;
+    if (line.len && line.data[line.len - 1] == '\n') {
+      line.len--;
+    }
+    line.data[line.len] = '\0';
+    return take_string(&line);
+  }
+
+  int eof = 1;
+  while (fill(p)) {
+    eof = 0;
+    char *start = p->in + p->in_pos, *nl = memchr(start, '\n', p->in_len - p->in_pos);
+    size_t len = nl ? (size_t) (nl - start) : p->in_len - p->in_pos;
+    append(&line, start, len);
+    p->in_pos += len;
+    if (nl) {
+      p->in_pos++;
+      break;
+    }
+  }
+  return eof ? scm_nil : take_string(&line);
+}
+
+/* (read-string k [port]) reads up to k characters, or returns () at end of file */
+static scm_object *pscm_read_string(int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_INTEGER || INT_VALUE(argv[0]) < 0) {
+    errx(1, "read-string: bad length");
+  }
+  size_t want = INT_VALUE(argv[0]);
+  struct port *p = port_arg(argc, argv, 1, 0, "read-string");
+  struct strbuf str = { 0 };
+
+  if (!p) {
+    char buf[PORT_BUFSIZE];
+    size_t n;
+    while (str.len < want && (n = fread(buf, 1, want - str.len < sizeof(buf) ? want - str.len : sizeof(buf), scheme_input))) {
+      append(&str, buf, n);
+    }
+  } else {
+    while (str.len < want && fill(p)) {
+      size_t n = p->in_len - p->in_pos < want - str.len ? p->in_len - p->in_pos : want - str.len;
+      append(&str, p->in + p->in_pos, n);
+      p->in_pos += n;
+    }
+  }
+  if (want && !str.len) {
+    return scm_nil;
+  }
+  return take_string(&str);
+}
+
+/* lets the reader work straight out of a port's input buffer */
+struct port_text {
+  struct text_source text;
+  struct port *port;
+};
+
+static int refill_text(struct text_source *text) {
+  struct port *p = ((struct port_text *) text)->port;
+  p->in_pos = text->pos - p->in;
+  if (!fill(p)) {
+    return 0;
+  }
+  text->pos = p->in + p->in_pos;
+  text->end = p->in + p->in_len;
+  return 1;
+}
+
+/* (read [port]) returns the next datum without evaluating it, or the symbol EOF at the end */
+static scm_object *pscm_read(int argc, scm_object **argv) {
+  struct port *p = port_arg(argc, argv, 0, 0, "read");
+  scm_object *datum;
+  if (!p) {
+    datum = read_datum(NULL);
+  } else {
+    struct port_text t = { { p->in + p->in_pos, p->in + p->in_len, refill_text, 0, 0 }, p };
+    datum = read_datum(&t.text);
+    p->in_pos = t.text.pos - p->in;
+  }
+  return datum ? datum : eof_sym;
+}
+
+/* (fasl-write obj [port]) writes obj in the binary form fasl.c describes */
+static scm_object *pscm_fasl_write(int argc, scm_object **argv) {
+  struct port *p = port_arg(argc, argv, 1, 1, "fasl-write");
+  size_t len;
+  char *data = fasl_encode(argv[0], &len);
+  int ok = p ? put(p, data, len) : fwrite(data, 1, len, stdout) == len;
+  free(data);
+  return SCM_BOOL(ok);
+}
+
+/* stdin goes a byte at a time, so nothing past the datum is taken from stdio */
+static int refill_stdin(struct text_source *text) {
+  static char c;
+  int ch = getc(scheme_input);
+  if (ch == EOF) {
+    return 0;
+  }
+  c = (char) ch;
+  text->pos = &c;
+  text->end = &c + 1;
+  return 1;
+}
+
+/* (fasl-read [port]) returns the next datum fasl-write wrote, or the symbol EOF at the end */
+static scm_object *pscm_fasl_read(int argc, scm_object **argv) {
+  struct port *p = port_arg(argc, argv, 0, 0, "fasl-read");
+  scm_object *datum;
+  if (!p) {
+    struct text_source t = { NULL, NULL, refill_stdin, 0, 0 };
+    datum = fasl_decode(&t);
+  } else {
+    struct port_text t = { { p->in + p->in_pos, p->in + p->in_len, refill_text, 0, 0 }, p };
+    datum = fasl_decode(&t.text);
+    p->in_pos = t.text.pos - p->in;
+  }
+  return datum ? datum : eof_sym;
+}
+
+static scm_object *pscm_write_string(int argc, scm_object **argv) {
+  if (TAG(argv[0]) != SCHEME_STRING) {
+    errx(1, "write-string: expected string, got %s", tag_str(TAG(argv[0])));
+  }
+  struct port *p = port_arg(argc, argv, 1, 1, "write-string");
+  if (!p) {
+    return SCM_BOOL(fwrite(argv[0]->buffer, 1, argv[0]->length, stdout) == argv[0]->length);
+  }
+  return SCM_BOOL(put(p, argv[0]->buffer, argv[0]->length));
+}
+
+static scm_object *pscm_flush_output(int argc, scm_object **argv) {
+  struct port *p = port_arg(argc, argv, 0, 1, "flush-output");
+  return SCM_BOOL(p ? flush(p) : fflush(stdout) == 0);
+}
+
+void port_init(void) {
+  atexit(flush_all);
+
+  add_procedure("open-file", pscm_open, 2, 2);
+  add_procedure("close-file", pscm_close, 1, 1);
+  add_procedure("port?", pscm_is_port, 1, 1);
+  add_procedure("read-char", pscm_read_char, 0, 1);
+  add_procedure("write-char", pscm_write_char, 1, 2);
+  add_procedure("read-line", pscm_read_line, 0, 1);
+  add_procedure("read", pscm_read, 0, 1);
+  add_procedure("fasl-write", pscm_fasl_write, 1, 2);
+  add_procedure("fasl-read", pscm_fasl_read, 0, 1);
+  add_procedure("read-string", pscm_read_string, 1, 2);
+  add_procedure("write-string", pscm_write_string, 1, 2);
+  add_procedure("flush-output", pscm_flush_output, 0, 1);
+}
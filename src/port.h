@@ -0,0 +1,10 @@
+#ifndef PORT_H_
+#define PORT_H_
+
+#include "scheme.h"
+
+void port_init(void);
+void port_free(scm_object *);
+void port_restore(scm_object *);
+
+#endif /* PORT_H_ */
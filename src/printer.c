@@ -0,0 +1,353 @@
+#include "printer.h"
+#include "lib.h"
+#include "number.h"
+#include "analyze.h"
+
+#include <inttypes.h>
+
+/*
+ * The printer walks cars and cdrs alike with an explicit stack, so deep
+ * structure doesn't recurse on the C stack, and writes through stdio
+ * without flushing; the REPL flushes before each prompt.
+ *
+ * With labels on, a first pass finds the pairs and vectors that are
+ * reachable again from inside themselves (LABEL_CYCLES) or from anywhere
+ * else (LABEL_SHARED), and the second prints them once as #n= and refer
+ * to them as #n# afterwards.
+ */
+
+/* pointer map from a labelled object to its state, open addressing */
+
+enum { SEEN_OPEN, SEEN_DONE, SEEN_LABEL }; /* SEEN_LABEL + n once #n= is out */
+
+struct seen {
+  scm_object **keys;
+  int *states;
+  size_t cap, count;
+  int labels; /* objects in SEEN_LABEL or above */
+};
+
+static size_t seen_slot(struct seen *s, scm_object *o) {
+  size_t mask = s->cap - 1, i = ((uintptr_t) o * 0x9e3779b97f4a7c15ull) >> 32 & mask;
+  while (s->keys[i] && s->keys[i] != o) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+static int *seen_find(struct seen *s, scm_object *o) {
+  if (!s->cap) {
+    return NULL;
+  }
+  size_t i = seen_slot(s, o);
+  return s->keys[i] ? &s->states[i] : NULL;
+}
+
+static void seen_add(struct seen *s, scm_object *o, int state) {
+  if ((s->count + 1) * 2 > s->cap) {
+    struct seen old = *s;
+    s->cap = old.cap ? old.cap * 2 : 64;
+    s->keys = calloc(s->cap, sizeof(*s->keys));
+    s->states = malloc(s->cap * sizeof(*s->states));
+    if (!s->keys || !s->states) {
+      err(1, "failed to grow printer table");
+    }
+    for (size_t i = 0; i < old.cap; i++) {
+      if (old.keys[i]) {
+        size_t j = seen_slot(s, old.keys[i]);
+        s->keys[j] = old.keys[i];
+        s->states[j] = old.states[i];
+      }
+    }
+    free(old.keys);
+    free(old.states);
+  }
+  size_t i = seen_slot(s, o);
+  s->keys[i] = o;
+  s->states[i] = state;
+  s->count++;
+}
+
+static int has_children(scm_object *o) {
+  return !IS_IMMEDIATE(o) && (o->tag == SCHEME_CONS || o->tag == SCHEME_VECTOR);
+}
+
+/* an explicit stack, shared by both passes */
+
+enum task_kind { T_OBJ, T_REST, T_VEC, T_TEXT };
+
+struct task {
+  enum task_kind kind;
+  union {
+    scm_object *obj;
+    const char *text;
+  };
+  size_t i;
+};
+
+struct stack {
+  struct task *tasks;
+  size_t len, cap;
+};
+
+static struct task *push(struct stack *st, enum task_kind kind, scm_object *obj) {
+  if (st->len == st->cap) {
+    st->cap = st->cap ? st->cap * 2 : 64;
+    if (!(st->tasks = realloc(st->tasks, st->cap * sizeof(*st->tasks)))) {
+      err(1, "failed to grow printer stack");
+    }
+  }
+  struct task *t = &st->tasks[st->len++];
+  *t = (struct task) { .kind = kind, .obj = obj, .i = 0 };
+  return t;
+}
+
+static void push_text(struct stack *st, const char *text) {
+  push(st, T_TEXT, NULL)->text = text;
+}
+
+/* depth-first over pairs and vectors; T_OBJ entries step through children with i */
+static void find_labels(struct seen *s, struct stack *st, scm_object *root, enum print_labels mode) {
+  seen_add(s, root, SEEN_OPEN);
+  push(st, T_OBJ, root);
+  while (st->len) {
+    struct task *t = &st->tasks[st->len - 1];
+    scm_object *o = t->obj, *child;
+    if (o->tag == SCHEME_CONS && t->i < 2) {
+      child = t->i++ ? CDR(o) : CAR(o);
+    } else if (o->tag == SCHEME_VECTOR && t->i < o->nslots) {
+      child = o->slots[t->i++];
+    } else {
+      int *state = seen_find(s, o);
+      if (*state == SEEN_OPEN) {
+        *state = SEEN_DONE;
+      }
+      st->len--;
+      continue;
+    }
+
+    if (!has_children(child)) {
+      continue;
+    }
+    int *state = seen_find(s, child);
+    if (!state) {
+      seen_add(s, child, SEEN_OPEN);
+      push(st, T_OBJ, child);
+    } else if (*state < SEEN_LABEL && (*state == SEEN_OPEN || mode == LABEL_SHARED)) {
+      *state = SEEN_LABEL;
+      s->labels++;
+    }
+  }
+}
+
+static void write_char_name(FILE *out, char c) {
+  switch (c) {
+    case '\n': fputs("newline", out); break;
+    case '\t': fputs("tab", out); break;
+    case ' ': fputs("space", out); break;
+    default: putc(c, out); break;
+  }
+}
+
+static void write_string(FILE *out, scm_object *str) {
+  putc('"', out);
+  for (size_t i = 0; i < str->length; i++) {
+    char c = str->buffer[i];
+    switch (c) {
+      case '\n': fputs("\\n", out); break;
+      case '\t': fputs("\\t", out); break;
+      case '"': fputs("\\\"", out); break;
+      case '\\': fputs("\\\\", out); break;
+      default: putc(c, out);
+    }
+  }
+  putc('"', out);
+}
+
+/* everything without children to walk */
+static void write_atom(FILE *out, scm_object *obj) {
+  switch (TAG(obj)) {
+    case SCHEME_INTEGER:
+    case SCHEME_BIGNUM: ;
+      char *digits = integer_to_string(obj);
+      fputs(digits, out);
+      free(digits);
+      break;
+    case SCHEME_TRUE:
+      fputs("#t", out);
+      break;
+    case SCHEME_FALSE:
+      fputs("#f", out);
+      break;
+    case SCHEME_NIL:
+      fputs("()", out);
+      break;
+    case SCHEME_CHARACTER:
+      fputs("#\\", out);
+      write_char_name(out, CHAR_VALUE(obj));
+      break;
+    case SCHEME_STRING:
+      write_string(out, obj);
+      break;
+    case SCHEME_SYMBOL:
+      fputs(obj->sym_value, out);
+      break;
+    case SCHEME_CLOSURE:
+      if (CADR(obj->expr)->slots[LAMBDA_NAME] != scm_f) {
+        fprintf(out, "#<closure %s>", CADR(obj->expr)->slots[LAMBDA_NAME]->sym_value);
+      } else {
+        fprintf(out, "#<closure %#.zx>", (size_t) obj);
+      }
+      break;
+    case SCHEME_PROC:
+      fprintf(out, "#<procedure %#.zx>", (size_t) obj->procedure);
+      break;
+    case SCHEME_FREE:
+      fprintf(out, "#<free %#.zx>", (size_t) obj);
+      break;
+    case SCHEME_FRAME:
+      fprintf(out, "#<frame %zu>", obj->nslots);
+      break;
+    case SCHEME_LOCAL:
+      fprintf(out, "#<local %d:%zu>", (int) LOCAL_DEPTH(obj), (size_t) LOCAL_SLOT(obj));
+      break;
+    case SCHEME_UNBOUND:
+      fputs("#<unbound>", out);
+      break;
+    case SCHEME_CONTINUATION:
+      fprintf(out, "#<continuation %#.zx>", (size_t) obj);
+      break;
+    case SCHEME_HASHTABLE:
+      fprintf(out, "#<hash-table %#.zx>", (size_t) obj);
+      break;
+    case SCHEME_PORT:
+      fprintf(out, "#<port %#.zx>", (size_t) obj);
+      break;
+    case SCHEME_S32VECTOR:
+    case SCHEME_S64VECTOR:
+      fputs(obj->tag == SCHEME_S32VECTOR ? "#s32(" : "#s64(", out);
+      for (size_t i = 0; i < obj->vec_len; i++) {
+        fprintf(out, i ? " %" PRId64 : "%" PRId64, obj->tag == SCHEME_S32VECTOR
+                ? (int64_t) ((int32_t *) obj->vec_data)[i] : ((int64_t *) obj->vec_data)[i]);
+      }
+      putc(')', out);
+      break;
+    case SCHEME_CONS:
+    case SCHEME_KNOT:
+    case SCHEME_VECTOR:
+      break; /* walked by scm_print */
+  }
+}
+
+/* prints #n# and returns 1 for an object already printed, or #n= the first time */
+static int write_label(FILE *out, struct seen *s, int *next, scm_object *o) {
+  int *state = s->labels ? seen_find(s, o) : NULL;
+  if (!state || *state < SEEN_LABEL) {
+    return 0;
+  }
+  if (*state > SEEN_LABEL) {
+    fprintf(out, "#%d#", *state - SEEN_LABEL - 1);
+    return 1;
+  }
+  fprintf(out, "#%d=", *next);
+  *state = SEEN_LABEL + 1 + (*next)++;
+  return 0;
+}
+
+static int is_labelled(struct seen *s, scm_object *o) {
+  int *state = s->labels ? seen_find(s, o) : NULL;
+  return state && *state >= SEEN_LABEL;
+}
+
+void scm_print(FILE *out, scm_object *root, enum print_labels mode) {
+  struct seen s = { 0 };
+  struct stack st = { 0 };
+  int next = 0;
+
+  if (mode != LABEL_NONE && has_children(root)) {
+    find_labels(&s, &st, root, mode);
+  }
+
+  push(&st, T_OBJ, root);
+  while (st.len) {
+    struct task t = st.tasks[--st.len];
+    scm_object *o = t.obj;
+    switch (t.kind) {
+      case T_TEXT:
+        fputs(t.text, out);
+        break;
+      case T_OBJ:
+        if (write_label(out, &s, &next, o)) {
+          break;
+        }
+        switch (TAG(o)) {
+          case SCHEME_CONS:
+            putc('(', out);
+            push(&st, T_REST, CDR(o));
+            push(&st, T_OBJ, CAR(o));
+            break;
+          case SCHEME_VECTOR:
+            fputs("#(", out);
+            push(&st, T_VEC, o);
+            break;
+          case SCHEME_KNOT:
+            fputs("#<knot: ", out);
+            push_text(&st, ">");
+            push(&st, T_OBJ, o->fwd);
+            break;
+          default:
+            write_atom(out, o);
+        }
+        break;
+      case T_REST:
+        /* the tail of a list, after its first element */
+        if (o == scm_nil) {
+          putc(')', out);
+        } else if (TAG(o) == SCHEME_CONS && !is_labelled(&s, o)) {
+          putc(' ', out);
+          push(&st, T_REST, CDR(o));
+          push(&st, T_OBJ, CAR(o));
+        } else {
+          fputs(" . ", out);
+          push_text(&st, ")");
+          push(&st, T_OBJ, o);
+        }
+        break;
+      case T_VEC:
+        if (t.i == o->nslots) {
+          putc(')', out);
+          break;
+        }
+        if (t.i) {
+          putc(' ', out);
+        }
+        push(&st, T_VEC, o)->i = t.i + 1;
+        push(&st, T_OBJ, o->slots[t.i]);
+        break;
+    }
+  }
+
+  free(st.tasks);
+  free(s.keys);
+  free(s.states);
+}
+
+int scm_write(scm_object *obj) {
+  scm_print(stdout, obj, LABEL_CYCLES);
+  return 0;
+}
+
+static scm_object *pscm_write_shared(UNUSED int argc, scm_object **argv) {
+  scm_print(stdout, argv[0], LABEL_SHARED);
+  return scm_t;
+}
+
+static scm_object *pscm_write_simple(UNUSED int argc, scm_object **argv) {
+  scm_print(stdout, argv[0], LABEL_NONE);
+  return scm_t;
+}
+
+void printer_init(void) {
+  add_procedure("write-shared", pscm_write_shared, 1, 1);
+  add_procedure("write-simple", pscm_write_simple, 1, 1);
+}
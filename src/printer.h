@@ -0,0 +1,18 @@
+#ifndef PRINTER_H_
+#define PRINTER_H_
+
+#include "scheme.h"
+
+/* which pairs and vectors get a #n= datum label */
+enum print_labels {
+  LABEL_NONE, /* loops forever on cyclic data */
+  LABEL_CYCLES,
+  LABEL_SHARED
+};
+
+void scm_print(FILE *, scm_object *, enum print_labels);
+int scm_write(scm_object *);
+
+void printer_init(void);
+
+#endif /* PRINTER_H_ */
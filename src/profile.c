@@ -0,0 +1,294 @@
+#include "profile.h"
+#include "lib.h"
+
+#include <sys/time.h>
+
+/*
+ * A sampling profiler. While it runs, eval and the vm keep prof_stack, the
+ * names of the closures being run, and SIGPROF fires every
+ * PROF_INTERVAL_USEC of CPU time. The handler only sets prof_pending; the
+ * next closure call records the stack, so a sample never catches the
+ * interpreter halfway through an update, and time spent in a primitive is
+ * charged to the procedure that called it.
+ *
+ * Procedures are named by the define or let that bound them. Anonymous
+ * lambdas are left out of the stacks and their time goes to the named
+ * procedure below them, or to the one they replaced by a tail call. Stacks
+ * are counted as they're sampled; at exit they're written out in the folded
+ * format flame graph tools read, and the busiest procedures are listed on
+ * stderr.
+ */
+
+#define PROF_INTERVAL_USEC 1000
+#define PROF_MAX_FRAMES 128 /* innermost frames kept per sample */
+#define PROF_TOP 20
+
+int profiling;
+volatile sig_atomic_t prof_pending;
+scm_object **prof_stack;
+size_t prof_depth, prof_cap;
+
+/* a distinct stack and how often it was sampled */
+struct prof_entry {
+  uint64_t hash;
+  size_t n, count;
+  scm_object **names; /* symbols outermost first, #f for the top level */
+};
+
+static struct {
+  struct prof_entry *entries;
+  size_t cap, used, samples;
+  const char *path;
+} prof;
+
+static void prof_trace(void) {
+  for (size_t i = 0; i < prof_depth; i++) {
+    gc_mark(prof_stack[i]);
+  }
+  for (size_t i = 0; i < prof.cap; i++) {
+    for (size_t j = 0; j < prof.entries[i].n; j++) {
+      gc_mark(prof.entries[i].names[j]);
+    }
+  }
+}
+
+void prof_grow(void) {
+  if (!prof_cap) {
+    gc_tracer(prof_trace);
+  }
+  prof_cap = prof_cap ? prof_cap * 2 : 256;
+  if (!(prof_stack = realloc(prof_stack, prof_cap * sizeof(*prof_stack)))) {
+    err(1, "failed to grow profiler stack");
+  }
+}
+
+static uint64_t hash_names(scm_object **names, size_t n) {
+  uint64_t h = 14695981039346656037ull;
+  for (size_t i = 0; i < n; i++) {
+    h = (h ^ (uintptr_t) names[i]) * 1099511628211ull;
+  }
+  return h ^ (h >> 29);
+}
+
+static struct prof_entry *find_entry(struct prof_entry *entries, size_t cap, uint64_t hash, scm_object **names, size_t n) {
+  size_t i = hash & (cap - 1);
+  for (struct prof_entry *e; (e = &entries[i])->names; i = (i + 1) & (cap - 1)) {
+    if (e->hash == hash && e->n == n && !memcmp(e->names, names, n * sizeof(*names))) {
+      break;
+    }
+  }
+  return &entries[i];
+}
+
+static void entries_grow(void) {
+  struct prof_entry *old = prof.entries;
+  size_t old_cap = prof.cap;
+  prof.cap = old_cap ? old_cap * 2 : 64;
+  if (!(prof.entries = calloc(prof.cap, sizeof(*prof.entries)))) {
+    err(1, "failed to grow profile");
+  }
+  for (size_t i = 0; i < old_cap; i++) {
+    if (old[i].names) {
+      *find_entry(prof.entries, prof.cap, old[i].hash, old[i].names, old[i].n) = old[i];
+    }
+  }
+  free(old);
+}
+
+void prof_sample(void) {
+  scm_object *names[PROF_MAX_FRAMES];
+  size_t n = 0;
+
+  prof_pending = 0;
+  for (size_t i = prof_depth; i-- > 0 && n < PROF_MAX_FRAMES;) {
+    if (prof_stack[i] != scm_f) {
+      names[n++] = prof_stack[i];
+    }
+  }
+  if (!n) {
+    names[n++] = scm_f;
+  }
+  for (size_t i = 0; i < n / 2; i++) {
+    scm_object *t = names[i];
+    names[i] = names[n - 1 - i];
+    names[n - 1 - i] = t;
+  }
+
+  if (2 * (prof.used + 1) > prof.cap) {
+    entries_grow();
+  }
+  uint64_t hash = hash_names(names, n);
+  struct prof_entry *e = find_entry(prof.entries, prof.cap, hash, names, n);
+  if (!e->names) {
+    if (!(e->names = malloc(n * sizeof(*names)))) {
+      err(1, "failed to record profile sample");
+    }
+    memcpy(e->names, names, n * sizeof(*names));
+    e->hash = hash;
+    e->n = n;
+    prof.used++;
+  }
+  e->count++;
+  prof.samples++;
+}
+
+static const char *name_str(scm_object *name) {
+  return name == scm_f ? "(toplevel)" : name->sym_value;
+}
+
+/* per procedure: samples it was running in, and samples it was anywhere on the stack in */
+struct prof_stat {
+  scm_object *name;
+  size_t self, total, last;
+};
+
+static int by_self(const void *a, const void *b) {
+  const struct prof_stat *x = a, *y = b;
+  if (x->self != y->self) {
+    return x->self < y->self ? 1 : -1;
+  }
+  return (x->total < y->total) - (x->total > y->total);
+}
+
+static void report_flat(void) {
+  size_t cap = 64, count = 0;
+  while (cap < 4 * prof.used) {
+    cap *= 2;
+  }
+  struct prof_stat *stats = calloc(cap, sizeof(*stats));
+  if (!stats) {
+    err(1, "failed to allocate profile report");
+  }
+
+  for (size_t i = 0; i < prof.cap; i++) {
+    struct prof_entry *e = &prof.entries[i];
+    for (size_t j = 0; j < e->n; j++) {
+      size_t k = ((uintptr_t) e->names[j] >> 3) & (cap - 1);
+      while (stats[k].name && stats[k].name != e->names[j]) {
+        k = (k + 1) & (cap - 1);
+      }
+      if (!stats[k].name) {
+        stats[k].name = e->names[j];
+        count++;
+      }
+      /* recursion counts once towards total */
+      if (stats[k].last != i + 1) {
+        stats[k].total += e->count;
+        stats[k].last = i + 1;
+      }
+      if (j == e->n - 1) {
+        stats[k].self += e->count;
+      }
+    }
+  }
+
+  qsort(stats, cap, sizeof(*stats), by_self);
+  fprintf(stderr, "%7s %7s  %s\n", "self", "total", "procedure");
+  for (size_t i = 0; i < count && i < PROF_TOP; i++) {
+    fprintf(stderr, "%6.1f%% %6.1f%%  %s\n", 100.0 * stats[i].self / prof.samples,
+        100.0 * stats[i].total / prof.samples, name_str(stats[i].name));
+  }
+  free(stats);
+}
+
+static void set_timer(long usec) {
+  struct itimerval t = { { 0, usec }, { 0, usec } };
+  if (setitimer(ITIMER_PROF, &t, NULL) == -1) {
+    err(1, "failed to set profiler timer");
+  }
+}
+
+static void report(void) {
+  if (profiling) {
+    set_timer(0);
+    profiling = 0;
+  }
+  if (!prof.samples) {
+    return;
+  }
+
+  const char *path = prof.path ? prof.path : "ponzi.prof";
+  FILE *out = fopen(path, "w");
+  if (!out) {
+    warn("failed to write profile %s", path);
+  } else {
+    for (size_t i = 0; i < prof.cap; i++) {
+      struct prof_entry *e = &prof.entries[i];
+      for (size_t j = 0; j < e->n; j++) {
+        fprintf(out, "%s%s", j ? ";" : "", name_str(e->names[j]));
+      }
+      if (e->n) {
+        fprintf(out, " %zu\n", e->count);
+      }
+    }
+    fclose(out);
+  }
+
+  fprintf(stderr, "profile: %zu samples, %d us apart; stacks folded into %s\n", prof.samples, PROF_INTERVAL_USEC, path);
+  report_flat();
+}
+
+static void on_sigprof(UNUSED int sig) {
+  prof_pending = 1;
+}
+
+/* starts sampling, with the folded stacks going to path at exit if it's set */
+void prof_start(const char *path) {
+  static int installed;
+  if (path) {
+    prof.path = path;
+  }
+  if (!installed) {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_sigprof;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGPROF, &sa, NULL) == -1) {
+      err(1, "failed to install profiler");
+    }
+    atexit(report);
+    installed = 1;
+  }
+  if (!profiling) {
+    set_timer(PROF_INTERVAL_USEC);
+    profiling = 1;
+  }
+}
+
+/* the C frame of the (profile thunk) call that started sampling, or NULL */
+static void *prof_frame;
+
+static void prof_stop(void) {
+  set_timer(0);
+  profiling = 0;
+  prof_pending = 0;
+  prof_frame = NULL;
+}
+
+/*
+ * Called before a continuation unwinds the C stack to the frame holding
+ * landing. Escaping past (profile thunk) ends its sampling; the stack grows
+ * down, so older frames are at higher addresses.
+ */
+void prof_unwind(void *landing) {
+  if (prof_frame && (uintptr_t) landing > (uintptr_t) prof_frame) {
+    prof_stop();
+  }
+}
+
+/* (profile thunk) samples the call of thunk and returns its value */
+static scm_object *pscm_profile(UNUSED int argc, scm_object **argv) {
+  if (profiling) {
+    return scm_apply(argv[0], 0, NULL);
+  }
+  prof_start(NULL);
+  prof_frame = __builtin_frame_address(0);
+  scm_object *val = scm_apply(argv[0], 0, NULL);
+  prof_stop();
+  return val;
+}
+
+void profile_init(void) {
+  add_procedure("profile", pscm_profile, 1, 1);
+}
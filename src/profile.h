@@ -0,0 +1,50 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+
+#include "scheme.h"
+#include "analyze.h"
+
+#include <signal.h>
+
+/* nonzero while the sampling profiler runs */
+extern int profiling;
+/* set by the timer; the next procedure call takes the sample */
+extern volatile sig_atomic_t prof_pending;
+
+/* names of the procedures being run, innermost last, #f for anonymous ones; kept while profiling */
+extern scm_object **prof_stack;
+extern size_t prof_depth, prof_cap;
+
+void prof_grow(void);
+void prof_sample(void);
+
+static inline void prof_push(scm_object *name) {
+  if (prof_depth == prof_cap) {
+    prof_grow();
+  }
+  prof_stack[prof_depth++] = name;
+}
+
+/*
+ * Called as a closure is entered, with the number of entries its caller
+ * keeps: one fewer than prof_depth when a tail call replaces the caller. An
+ * anonymous lambda replacing its caller, like a let in tail position, goes
+ * on under the caller's name. A pending sample goes to the caller.
+ */
+static inline void prof_enter(scm_object *lambda, size_t keep) {
+  if (prof_pending) {
+    prof_sample();
+  }
+  scm_object *name = CADR(lambda)->slots[LAMBDA_NAME];
+  if (name == scm_f && keep < prof_depth) {
+    name = prof_stack[keep];
+  }
+  prof_depth = keep;
+  prof_push(name);
+}
+
+void prof_start(const char *path);
+void prof_unwind(void *landing);
+void profile_init(void);
+
+#endif /* PROFILE_H_ */
@@ -1,4 +1,74 @@
 #include "reader.h"
+#include "number.h"
+#include "numvec.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+FILE *scheme_input;
+
+/*
+ * Files and ports are read from memory through a text_source: read_file
+ * maps the whole file, a port hands over its input buffer and refills it.
+ * Symbols are interned straight from slices of the text and string literals
+ * are measured before they're copied, unless the token runs off the end of
+ * a buffer that's about to be refilled. The REPL reads scheme_input a
+ * character at a time as before.
+ *
+ * map_pos and map_end cache the current source's window while reading.
+ */
+static struct text_source *source;
+static const char *map_pos, *map_end;
+
+/* scratch space for tokens from scheme_input, or split across a refill */
+static char *token;
+static size_t token_cap;
+
+static void token_put(size_t i, char c) {
+  if (i == token_cap && !(token = realloc(token, token_cap = token_cap ? token_cap * 2 : 64))) {
+    err(1, "failed to grow token buffer");
+  }
+  token[i] = c;
+}
+
+static int refill(void) {
+  if (!source->refill) {
+    return 0;
+  }
+  source->pos = map_pos;
+  if (!source->refill(source)) {
+    return 0;
+  }
+  map_pos = source->pos;
+  map_end = source->end;
+  return 1;
+}
+
+/* whether a token scanned up to p lies wholly in the window */
+static int in_window(const char *p) {
+  return p < map_end || !source->refill;
+}
+
+static int next(void) {
+  if (source) {
+    return map_pos < map_end || refill() ? (unsigned char) *map_pos++ : EOF;
+  }
+  return getc(scheme_input);
+}
+
+/* c must be the character next() just returned */
+static void unread(int c) {
+  if (c == EOF) {
+    return;
+  }
+  if (source) {
+    map_pos--;
+  } else {
+    ungetc(c, scheme_input);
+  }
+}
 
 int is_delim(char ch) {
   return isspace(ch) || (ch == '(') || (ch == ')') || (ch == '\n') || (ch == ';') || ch == EOF || ch == '"';
@@ -8,18 +78,18 @@ int is_initial(int c) {
     return isalpha(c) || c == '*' || c == '/' || c == '>' || c == '<' || c == '=' || c == '?' || c == '!';
 }
 
-int peek() {
-  int ch = getc(scheme_input);
-  if (ch == EOF) {
-    return EOF;
-  }
-  ungetc(ch, scheme_input);
+static int is_subsequent(int c) {
+  return is_initial(c) || isdigit(c) || c == '+' || c == '-';
+}
 
+int peek() {
+  int ch = next();
+  unread(ch);
   return ch;
 }
 
 int getch(int *linum, int *colnum) {
-  int c = getc(scheme_input);
+  int c = next();
   if (c == '\n') {
     *colnum = 0;
     (*linum)++;
@@ -36,7 +106,7 @@ void skip_spaces(int *linum, int *colnum) {
       while ((c = getch(linum, colnum)) != EOF && c != '\n') {}
       continue;
     }
-    ungetc(c, scheme_input);
+    unread(c);
     return;
   }
 }
@@ -89,12 +159,31 @@ scm_object *read_scm_char(int *linum, int *colnum) {
 }
 
 
+/* the decoded length of a string literal in the window, or SIZE_MAX if it doesn't end there */
+static size_t string_length(void) {
+  size_t len = 0;
+  for (const char *p = map_pos; p < map_end; p++, len++) {
+    if (*p == '"') {
+      return len;
+    }
+    if (*p == '\\') {
+      p++;
+    }
+  }
+  return SIZE_MAX;
+}
+
 scm_object *read_scm_string(int *linum, int *colnum) {
-  size_t size = 0, cap = 256;
+  size_t size = 0, cap = source ? string_length() : SIZE_MAX;
+  cap = cap == SIZE_MAX ? 64 : cap + 1;
   int ch;
   char *buffer = malloc(cap);
   char value;
 
+  if (!buffer) {
+    err(1, "failed to allocate string literal");
+  }
+
   while ((ch = getch(linum, colnum)) != '"') {
     switch(ch) {
       case '\\':
@@ -124,85 +213,156 @@ scm_object *read_scm_string(int *linum, int *colnum) {
         break;
     }
 
-    if (size + 1 > cap) {
-      buffer = realloc(buffer, cap + 64);
+    /* keep room for the terminator */
+    if (size + 2 > cap && !(buffer = realloc(buffer, cap *= 2))) {
+      err(1, "failed to grow string literal");
     }
     buffer[size++] = value;
   }
+  buffer[size] = '\0';
 
   expect_delim(*linum, *colnum, "string literal");
+  if (size + 1 < cap) {
+    buffer = realloc(buffer, size + 1);
+  }
   return new_string(buffer, size);
 }
 
-scm_object *read_scm_list(int *linum, int *colnum) {
-  scm_object *car = scm_read(linum, colnum);
-  skip_spaces(linum, colnum);
+scm_object *read_scm_integer(char c, int *linum, int *colnum) {
+  int negative = c == '-';
+  const char *digits;
+  size_t len = 0;
 
-  int ch;
-  switch (ch = peek()) {
-    case '.':
-      getch(linum, colnum);
-      scm_object *cdr = scm_read(linum, colnum);
-      skip_spaces(linum, colnum);
-      if (getch(linum, colnum) != ')') {
-        errx(1, "expected closing ')' at %d:%d", *linum, *colnum);
+  if (source) {
+    digits = negative ? map_pos : map_pos - 1;
+    const char *p = digits;
+    while (p < map_end && isdigit((unsigned char) *p)) {
+      p++;
+    }
+    if (in_window(p)) {
+      len = p - digits;
+      *colnum += len - !negative;
+      map_pos = p;
+      if (!is_delim(c = peek())) {
+        errx(1, "expecting delimiter at %d:%d, got '%c'", *linum, *colnum, c);
       }
-      return cons(car, cdr);
-    case ')':
-      getch(linum, colnum);
-      return cons(car, scm_nil);
-    default:
-      cdr = read_scm_list(linum, colnum);
-      return cons(car, cdr);
+      return parse_integer(digits, len, negative);
+    }
   }
-}
 
-scm_object *read_scm_integer(char c, int *linum, int *colnum) {
-  short sign = 1;
-  int num = 0;
-
-  if (c == '-') { sign = -1; } else { ungetc(c, scheme_input); }
+  if (!negative) {
+    unread(c);
+  }
   while (isdigit(c = getch(linum, colnum))) {
-    num = (num * 10) + (c - '0');
+    token_put(len++, c);
   }
-  num *= sign;
-  if (is_delim(c)) {
-    ungetc(c, scheme_input);
-    return new_integer(num);
-  } else {
+  unread(c);
+  if (!is_delim(c)) {
     errx(1, "expecting delimiter at %d:%d, got '%c'", *linum, *colnum, c);
   }
+  return parse_integer(token, len, negative);
 }
 
 scm_object *read_scm_symbol(char c, int *linum, int *colnum) {
-  size_t i = 0, cap = 256;
-  char *buf = malloc(cap);
-  while (is_initial(c) || isdigit(c) || c == '+' || c == '-') {
-    if (i + 1 < cap) {
-      buf[i++] = c;
-    } else {
-      buf[i] = '\0';
-      errx(1, "symbol '%s' too long at %d:%d", buf, *linum, *colnum);
+  size_t len = 0;
+
+  if (source) {
+    const char *name = map_pos - 1, *p = map_pos;
+    while (p < map_end && is_subsequent((unsigned char) *p)) {
+      p++;
+    }
+    if (in_window(p)) {
+      len = p - name;
+      *colnum += len - 1;
+      map_pos = p;
+      if (!is_delim(peek())) {
+        errx(1, "expecting delimiter after symbol at %d:%d", *linum, *colnum);
+      }
+      return intern(name, len);
     }
+  }
+
+  while (is_subsequent(c)) {
+    token_put(len++, c);
     c = getch(linum, colnum);
   }
-  if (is_delim(c)) {
-    buf[i] = '\0';
-    ungetc(c, scheme_input);
-    scm_object *x = make_symbol(buf);
-    free(buf);
-    return x;
-  } else {
+  unread(c);
+  if (!is_delim(c)) {
     errx(1, "expecting delimiter after symbol at %d:%d", *linum, *colnum);
   }
+  return intern(token, len);
 }
 
-scm_object *scm_read(int *linum, int *colnum) {
-  int c;
+/*
+ * Lists, vectors and quote forms under construction, kept off the C stack
+ * so neither deep nor long data can overflow it. The collector can't see
+ * this stack, so it's traced explicitly.
+ */
+enum pending_kind { PENDING_LIST, PENDING_VECTOR, PENDING_S32VECTOR, PENDING_S64VECTOR, PENDING_QUOTE };
+
+struct pending {
+  enum pending_kind kind;
+  scm_object *head, *tail; /* for a quote, head is the quoting symbol */
+  int dotted;
+};
+
+static struct pending *pending;
+static size_t pending_len, pending_cap;
+
+static void pending_trace(void) {
+  for (size_t i = 0; i < pending_len; i++) {
+    gc_mark(pending[i].head);
+    gc_mark(pending[i].tail);
+  }
+}
 
-  skip_spaces(linum, colnum);
+static void push_pending(enum pending_kind kind, scm_object *head) {
+  if (pending_len == pending_cap) {
+    if (!pending_cap) {
+      gc_tracer(pending_trace);
+    }
+    pending_cap = pending_cap ? pending_cap * 2 : 32;
+    if (!(pending = realloc(pending, pending_cap * sizeof(*pending)))) {
+      err(1, "failed to grow reader stack");
+    }
+  }
+  pending[pending_len++] = (struct pending) { kind, head, NULL, 0 };
+}
+
+static scm_object *list_to_vector(scm_object *elems) {
+  size_t n = 0;
+  for (scm_object *e = elems; e != scm_nil; e = CDR(e)) {
+    n++;
+  }
+  scm_object *v = new_vector(n, scm_nil);
+  for (size_t i = 0; i < n; i++, elems = CDR(elems)) {
+    v->slots[i] = CAR(elems);
+  }
+  return v;
+}
 
-  c = getch(linum, colnum);
+/* the datum a closed list or vector stands for */
+static scm_object *finish_pending(struct pending *p) {
+  switch (p->kind) {
+    case PENDING_VECTOR: return list_to_vector(p->head);
+    case PENDING_S32VECTOR: return list_to_numvec(SCHEME_S32VECTOR, p->head);
+    case PENDING_S64VECTOR: return list_to_numvec(SCHEME_S64VECTOR, p->head);
+    default: return p->head;
+  }
+}
+
+/* after #s, the 32( or 64( of a numeric vector */
+static enum pending_kind read_numvec_prefix(int *linum, int *colnum) {
+  int a = getch(linum, colnum), b = getch(linum, colnum);
+  if (getch(linum, colnum) != '(' || !((a == '3' && b == '2') || (a == '6' && b == '4'))) {
+    errx(1, "expecting #s32( or #s64( at %d:%d", *linum, *colnum);
+  }
+  return a == '3' ? PENDING_S32VECTOR : PENDING_S64VECTOR;
+}
+
+/* reads the next token, returning NULL if it opened a list, vector or quote */
+static scm_object *read_token(int *linum, int *colnum) {
+  int c = getch(linum, colnum);
   if (isdigit(c) || (c == '-' && isdigit(peek()))) {
     return read_scm_integer(c, linum, colnum);
   } else if (c == '#') {
@@ -213,31 +373,173 @@ scm_object *scm_read(int *linum, int *colnum) {
         return scm_f;
       case '\\':
         return read_scm_char(linum, colnum);
+      case '(':
+        push_pending(PENDING_VECTOR, scm_nil);
+        return NULL;
+      case 's':
+        push_pending(read_numvec_prefix(linum, colnum), scm_nil);
+        return NULL;
       default:
         errx(1, "expecting boolean at %d:%d (#t/#f), got '%c'", *linum, *colnum, c);
     }
   } else if (c == '"') {
     return read_scm_string(linum, colnum);
   } else if (c == '(') {
-    switch(peek()) {
-      case ')':
-        getch(linum, colnum);
-        return scm_nil;
-      default:
-        return read_scm_list(linum, colnum);
+    if (peek() == ')') {
+      getch(linum, colnum);
+      return scm_nil;
     }
+    push_pending(PENDING_LIST, scm_nil);
+    return NULL;
   } else if (is_initial(c) || ((c == '+' || c == '-') && is_delim(peek()))) {
     return read_scm_symbol(c, linum, colnum);
   } else if (c == '\'') {
-    return cons(quote_sym, cons(scm_read(linum, colnum), scm_nil));
+    push_pending(PENDING_QUOTE, quote_sym);
+    return NULL;
   } else if (c == '`') {
-    return cons(quasiquote_sym, cons(scm_read(linum, colnum), scm_nil));
+    push_pending(PENDING_QUOTE, quasiquote_sym);
+    return NULL;
   } else if (c == ',') {
-    return cons(unquote_sym, cons(scm_read(linum, colnum), scm_nil));
+    push_pending(PENDING_QUOTE, unquote_sym);
+    return NULL;
   } else if (c == EOF) {
+    if (pending_len) {
+      errx(1, "unexpected end of input in list at %d:%d", *linum, *colnum);
+    }
     return cons(quote_sym, cons(eof_sym, scm_nil));
   } else {
     errx(1, "unexpected '%c' at %d:%d\n", c, *linum, *colnum);
   }
 }
 
+scm_object *scm_read(int *linum, int *colnum) {
+  size_t base = pending_len;
+
+  for (;;) {
+    scm_object *obj = NULL;
+    skip_spaces(linum, colnum);
+
+    struct pending *top = pending_len > base ? &pending[pending_len - 1] : NULL;
+    if (top && top->kind != PENDING_QUOTE) {
+      int c = peek();
+      if (c == ')') {
+        if (top->dotted) {
+          errx(1, "missing datum after '.' at %d:%d", *linum, *colnum);
+        }
+        getch(linum, colnum);
+        obj = finish_pending(top);
+        pending_len--;
+      } else if (c == '.' && top->kind == PENDING_LIST && top->head != scm_nil) {
+        getch(linum, colnum);
+        top->dotted = 1;
+        continue;
+      }
+    }
+    if (!obj && !(obj = read_token(linum, colnum))) {
+      continue;
+    }
+
+    /* hand the datum to whatever is waiting for it */
+    for (;;) {
+      if (pending_len == base) {
+        return obj;
+      }
+      top = &pending[pending_len - 1];
+      if (top->kind == PENDING_QUOTE) {
+        obj = cons(top->head, cons(obj, scm_nil));
+        pending_len--;
+      } else if (top->dotted) {
+        CDR(top->tail) = obj;
+        skip_spaces(linum, colnum);
+        if (getch(linum, colnum) != ')') {
+          errx(1, "expected closing ')' at %d:%d", *linum, *colnum);
+        }
+        obj = top->head;
+        pending_len--;
+      } else {
+        scm_object *cell = cons(obj, scm_nil);
+        if (top->head == scm_nil) {
+          top->head = cell;
+        } else {
+          CDR(top->tail) = cell;
+        }
+        top->tail = cell;
+        break;
+      }
+    }
+  }
+}
+
+/* the next datum from src, or from scheme_input if src is NULL; NULL at the end of the text */
+scm_object *read_datum(struct text_source *src) {
+  static int stdin_line, stdin_col;
+  int *line = src ? &src->line : &stdin_line, *col = src ? &src->col : &stdin_col;
+
+  struct text_source *saved = source;
+  if (saved) {
+    saved->pos = map_pos;
+  }
+  if ((source = src)) {
+    map_pos = src->pos;
+    map_end = src->end;
+  }
+
+  scm_object *datum = NULL;
+  skip_spaces(line, col);
+  if (peek() != EOF) {
+    datum = scm_read(line, col);
+  }
+
+  if (src) {
+    src->pos = map_pos;
+  }
+  if ((source = saved)) {
+    map_pos = saved->pos;
+    map_end = saved->end;
+  }
+  return datum;
+}
+
+/* hands every datum in the file at path to fn, or returns 0 if it can't be read */
+int read_file(const char *path, scm_object *(*fn)(scm_object *)) {
+  int fd = open(path, O_RDONLY);
+  struct stat st;
+  if (fd == -1) {
+    return 0;
+  }
+  if (fstat(fd, &st) == -1) {
+    close(fd);
+    return 0;
+  }
+
+  /* pipes and the like are copied into memory instead */
+  size_t size = st.st_size;
+  char *text = S_ISREG(st.st_mode) && size ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+  int is_mapping = text != MAP_FAILED;
+  if (!is_mapping) {
+    size_t cap = 4096;
+    ssize_t n;
+    text = malloc(cap);
+    for (size = 0; text && (n = read(fd, text + size, cap - size)) > 0;) {
+      if ((size += n) == cap) {
+        text = realloc(text, cap *= 2);
+      }
+    }
+    if (!text) {
+      err(1, "failed to read %s", path);
+    }
+  }
+  close(fd);
+
+  struct text_source src = { text, text + size, NULL, 0, 0 };
+  for (scm_object *datum; (datum = read_datum(&src));) {
+    fn(datum);
+  }
+
+  if (is_mapping) {
+    munmap(text, size);
+  } else {
+    free(text);
+  }
+  return 1;
+}
@@ -3,9 +3,18 @@
 
 #include "scheme.h"
 
-FILE *scheme_input;
+extern FILE *scheme_input;
+
+/* text in memory; refill, if set, moves pos and end on to more and returns 0 at the end */
+struct text_source {
+  const char *pos, *end;
+  int (*refill)(struct text_source *);
+  int line, col;
+};
 
 int peek();
 scm_object *scm_read(int *, int *);
+scm_object *read_datum(struct text_source *);
+int read_file(const char *path, scm_object *(*fn)(scm_object *));
 
 #endif /* READER_H_ */
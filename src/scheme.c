@@ -1,6 +1,13 @@
 #include "scheme.h"
 #include "reader.h"
 #include "lib.h"
+#include "analyze.h"
+#include "vm.h"
+#include "expand.h"
+#include "printer.h"
+#include "image.h"
+#include "profile.h"
+#include "stats.h"
 
 const char *tag_str(enum obj_tag tag) {
   switch (tag) {
@@ -15,69 +22,95 @@ const char *tag_str(enum obj_tag tag) {
     case SCHEME_CLOSURE: return "closure";
     case SCHEME_PROC: return "procedure";
     case SCHEME_KNOT: return "knot";
+    case SCHEME_FREE: return "free";
+    case SCHEME_FRAME: return "frame";
+    case SCHEME_LOCAL: return "local";
+    case SCHEME_UNBOUND: return "unbound";
+    case SCHEME_CONTINUATION: return "continuation";
+    case SCHEME_BIGNUM: return "bignum";
+    case SCHEME_S32VECTOR: return "s32vector";
+    case SCHEME_S64VECTOR: return "s64vector";
+    case SCHEME_VECTOR: return "vector";
+    case SCHEME_HASHTABLE: return "hash-table";
+    case SCHEME_PORT: return "port";
     default: errx(1, "unknown object tag %d", tag);
   }
 }
 
 int is_self_eval(scm_object *obj) {
+  if (IS_IMMEDIATE(obj)) {
+    return 1;
+  }
   int d = obj->tag;
-  return d == SCHEME_TRUE ||
-    d == SCHEME_FALSE ||
-    d == SCHEME_CHARACTER ||
-    d == SCHEME_STRING ||
-    d == SCHEME_INTEGER ||
+  return d == SCHEME_STRING ||
+    d == SCHEME_BIGNUM ||
+    d == SCHEME_S32VECTOR ||
+    d == SCHEME_S64VECTOR ||
+    d == SCHEME_VECTOR ||
+    d == SCHEME_HASHTABLE ||
+    d == SCHEME_PORT ||
     d == SCHEME_CLOSURE ||
-    d == SCHEME_PROC ||
-    d == SCHEME_NIL;
+    d == SCHEME_PROC;
 }
 
 int is_special(scm_object *o, scm_object *tag) {
-  return o->tag == SCHEME_CONS && CAR(o) == tag;
+  return !IS_IMMEDIATE(o) && o->tag == SCHEME_CONS && CAR(o) == tag;
 }
 
-scm_object *eval(scm_object *obj, scm_object **env) {
-tailcall:
+/* leaves eval, dropping the profiler entry of any closure this call entered */
+#define RETURN(X) do { scm_object *ret_ = (X); prof_depth = prof_base; return ret_; } while (0)
 
-  if (is_self_eval(obj)) {
-    return obj;
-  } else if (is_special(obj, quote_sym)) {
-    return CADR(obj);
-  } else if (is_special(obj, define_sym)) {
-    scm_object *name = CADR(obj), *expr = CADDR(obj);
-    if (name->tag == SCHEME_CONS) {
-      expr = cons(lambda_sym, cons(CDR(name), CDDR(obj))), name = CAR(name);
-    } else if (name->tag != SCHEME_SYMBOL) {
-      errx(1, "can't define %s", tag_str(name->tag));
-    }
-    scm_object *hole = new(SCHEME_KNOT);
+/*
+ * prof_base is the profiler depth obj's caller keeps: a closure obj calls
+ * in tail position replaces the entries above it. It's prof_depth unless
+ * obj ends the body of a closure scm_apply entered.
+ */
+static scm_object *eval_at(scm_object *obj, scm_object **env, size_t prof_base) {
+  scm_object *frame;
 
-    scm_object *new_env =
-      cons(cons(name, hole), *env);
+tailcall:
+  stats.steps++;
 
-    hole->fwd = eval(expr, &new_env);
-    *env = cons(cons(name, hole->fwd), *env);
+  if (IS_LOCAL(obj)) {
+    scm_object *val = *local_slot((*env)->slots, obj);
+    if (is_knot(val)) {
+      val = val->fwd;
+    }
+    if (val == SCM_UNBOUND) {
+      errx(1, "local variable referenced before its definition");
+    }
+    RETURN(val);
+  } else if (is_self_eval(obj)) {
+    RETURN(obj);
+  } else if (is_special(obj, quote_sym)) {
+    RETURN(CADR(obj));
+  } else if (is_special(obj, define_sym) || is_special(obj, set_sym)) {
+    scm_object *name = CADR(obj), *val = eval(CADDR(obj), env), **slot;
 
-    return hole->fwd;
-  } else if (is_special(obj, lambda_sym)) {
-    switch (CADR(obj)->tag) {
-      case SCHEME_CONS:
-      case SCHEME_NIL:
-      case SCHEME_SYMBOL:
-        break;
-      default:
-        errx(1, "parameter of lambda must be a list or symbol, got %s", tag_str(CADR(obj)->tag));
+    if (IS_LOCAL(name)) {
+      slot = local_slot((*env)->slots, name);
+      if (is_knot(*slot)) {
+        slot = &(*slot)->fwd;
+      }
+    } else if (CAR(obj) == set_sym && name->sym_global == SCM_UNBOUND) {
+      errx(1, "set!: no binding for symbol %s", name->sym_value);
+    } else {
+      slot = &name->sym_global;
     }
+    *slot = val;
 
-    return new_closure(*env, obj);
+    RETURN(CAR(obj) == define_sym ? val : scm_t);
+  } else if (is_special(obj, lambda_sym)) {
+    RETURN(make_closure(obj, *env == scm_nil ? NULL : (*env)->slots));
   } else if (is_special(obj, if_sym)) {
     scm_object *cond = CADR(obj), *if_body = CADDR(obj);
     scm_object *else_body = scm_nil;
 
-    if (CDDDR(obj)->tag == SCHEME_CONS) {
+    if (TAG(CDDDR(obj)) == SCHEME_CONS) {
       else_body = CADDDR(obj);
     }
 
-    switch (eval(cond, env)->tag) {
+    switch (TAG(eval(cond, env))) {
       case SCHEME_FALSE:
         obj = else_body;
         goto tailcall;
@@ -85,97 +118,219 @@ tailcall:
         obj = if_body;
         goto tailcall;
     }
-  } else if (obj->tag == SCHEME_SYMBOL) {
-    scm_object *elem = *env;
-
-    while (elem->tag != SCHEME_NIL) {
-      assert(elem->tag == SCHEME_CONS);
-      assert(CAR(elem)->tag == SCHEME_CONS);
-      assert(CAAR(elem)->tag == SCHEME_SYMBOL);
-
-      if (CAAR(elem) == obj) {
-        return CDAR(elem);
-      }
-      elem = CDR(elem);
+  } else if (is_special(obj, begin_sym)) {
+    obj = CDR(obj);
+    goto sequence;
+  } else if (is_special(obj, let_sym)) {
+    for (scm_object *b = CADR(obj); b != scm_nil; b = CDR(b)) {
+      scm_object *init = CDAR(b);
+      *local_slot((*env)->slots, CAAR(b)) = init == SCM_UNBOUND ? init : eval(init, env);
     }
-
-    errx(1, "no binding for symbol %s", obj->sym_value);
-  } else if (obj->tag == SCHEME_CONS) {
+    obj = CDDR(obj);
+    goto sequence;
+  } else if (is_special(obj, case_sym)) {
+    scm_object *key = eval(CADR(obj), env), *c = CDDR(obj);
+    while (c != scm_nil && !case_matches(key, CAAR(c))) {
+      c = CDR(c);
+    }
+    if (c == scm_nil) {
+      RETURN(scm_f);
+    }
+    obj = CDAR(c);
+    goto sequence;
+  } else if (TAG(obj) == SCHEME_SYMBOL) {
+    if (obj->sym_global == SCM_UNBOUND) {
+      errx(1, "no binding for symbol %s", obj->sym_value);
+    }
+    RETURN(obj->sym_global);
+  } else if (TAG(obj) == SCHEME_CONS) {
     scm_object *fun = eval(CAR(obj), env);
 
-    switch (fun->tag) {
+    switch (TAG(fun)) {
       case SCHEME_CLOSURE: ;
-        scm_object *closure_env = fun->env,
+        scm_object *info = CADR(fun->expr),
                    *closure_body = CDDR(fun->expr),
-                   *closure_args = CADR(fun->expr),
-                   *params_zipped;
-
-        switch (closure_args->tag) {
-          case SCHEME_NIL:
-          case SCHEME_CONS:
-            params_zipped = zip_eval(closure_args, CDR(obj), env);
-            break;
-          case SCHEME_SYMBOL:
-            params_zipped = cons(cons(closure_args, map_eval(CDR(obj), env)), scm_nil);
-            break;
-          default:
-            errx(1, "unsupported object %s as arguments of closure", tag_str(closure_args->tag));
+                   *args = CDR(obj);
+        size_t nreq = INT_VALUE(info->slots[LAMBDA_NREQ]), i = 1;
+
+        scm_object *call_frame = new_frame(INT_VALUE(info->slots[LAMBDA_NSLOTS]));
+        call_frame->slots[0] = fun->env;
+        for (; i <= nreq && args != scm_nil; i++, args = CDR(args)) {
+          call_frame->slots[i] = eval(CAR(args), env);
+        }
+        if (info->slots[LAMBDA_REST] == scm_t) {
+          call_frame->slots[nreq + 1] = map_eval(args, env);
+        } else {
+          /* surplus arguments are dropped, but evaluated like the rest, as the vm does */
+          for (; args != scm_nil; args = CDR(args)) {
+            eval(CAR(args), env);
+          }
         }
 
-        scm_object *new_env = append(params_zipped, closure_env);
-        env = &new_env;
+        stats.closure_calls++;
+        if (profiling) {
+          prof_enter(fun->expr, prof_base);
+        }
+        frame = call_frame;
+        env = &frame;
+        obj = closure_body;
+        goto sequence;
 
-        while (CDR(closure_body)->tag != SCHEME_NIL) {
-          eval(CAR(closure_body), env);
-          closure_body = CDR(closure_body);
+      case SCHEME_PROC: {
+        scm_object *args = CDR(obj);
+        if (fun->proc_op != PRIM_NONE && args != scm_nil && (CDR(args) == scm_nil || CDDR(args) == scm_nil)) {
+          /* a core primitive on one or two arguments runs inline */
+          scm_object *argv[2], *val;
+          int argc = CDR(args) == scm_nil ? 1 : 2;
+          argv[0] = eval(CAR(args), env);
+          if (argc == 2) {
+            argv[1] = eval(CADR(args), env);
+          }
+          stats.primitive_calls++;
+          if ((val = prim_inline(fun->proc_op, argc, argv))) {
+            RETURN(val);
+          }
+          check_arity(fun, argc);
+          RETURN(fun->procedure(argc, argv));
         }
 
-        obj = CAR(closure_body);
-        goto tailcall;
+        int argc = 0;
+        for (scm_object *a = args; a != scm_nil; a = CDR(a)) {
+          argc++;
+        }
+        check_arity(fun, argc);
 
-      case SCHEME_PROC: ;
-        scm_object *args = scm_nil;
+        scm_object *argv[argc ? argc : 1];
         obj = CDR(obj);
-        while (obj->tag != SCHEME_NIL) {
-          args = cons(eval(CAR(obj), env), args);
-          obj = CDR(obj);
+        for (int j = 0; j < argc; j++, obj = CDR(obj)) {
+          argv[j] = eval(CAR(obj), env);
         }
-        return fun->procedure(append(args, scm_nil), env);
+        stats.primitive_calls++;
+        RETURN(fun->procedure(argc, argv));
+      }
 
-      case SCHEME_KNOT:
-        obj = cons(fun->fwd, CDR(obj));
-        goto tailcall;
+      case SCHEME_CONTINUATION:
+        if (scm_len(CDR(obj)) != 1) {
+          errx(1, "continuation expects 1 argument, got %d", scm_len(CDR(obj)));
+        }
+        throw_to(fun, eval(CADR(obj), env));
 
-      default: errx(1, "can't apply obj of type %s", tag_str(fun->tag));
+      default: errx(1, "can't apply obj of type %s", tag_str(TAG(fun)));
     }
-  } else if (obj->tag == SCHEME_KNOT) {
-    obj = obj->fwd;
-    goto tailcall;
   } else {
-    errx(1, "can't eval obj with type %d", obj->tag);
+    errx(1, "can't eval obj with type %d", TAG(obj));
   }
+
+sequence:
+  /* obj is a list of forms, the last of which is in tail position */
+  for (; CDR(obj) != scm_nil; obj = CDR(obj)) {
+    eval(CAR(obj), env);
+  }
+  obj = CAR(obj);
+  goto tailcall;
+}
+
+#undef RETURN
+
+scm_object *eval(scm_object *obj, scm_object **env) {
+  return eval_at(obj, env, prof_depth);
+}
+
+/* call a procedure on evaluated arguments */
+scm_object *scm_apply(scm_object *fun, int argc, scm_object **argv) {
+  switch (TAG(fun)) {
+    case SCHEME_PROC:
+      check_arity(fun, argc);
+      stats.primitive_calls++;
+      return fun->procedure(argc, argv);
+    case SCHEME_CLOSURE:
+      break;
+    case SCHEME_CONTINUATION:
+      if (argc != 1) {
+        errx(1, "continuation expects 1 argument, got %d", argc);
+      }
+      throw_to(fun, argv[0]);
+    default: errx(1, "can't apply obj of type %s", tag_str(TAG(fun)));
+  }
+
+  if (use_vm) {
+    return vm_apply(fun, argc, argv);
+  }
+
+  scm_object *info = CADR(fun->expr), *body = CDDR(fun->expr), *val = scm_nil;
+  int nreq = INT_VALUE(info->slots[LAMBDA_NREQ]), i = 0;
+
+  scm_object *frame = new_frame(INT_VALUE(info->slots[LAMBDA_NSLOTS]));
+  frame->slots[0] = fun->env;
+  for (; i < nreq && i < argc; i++) {
+    frame->slots[i + 1] = argv[i];
+  }
+  if (info->slots[LAMBDA_REST] == scm_t) {
+    scm_object *rest = scm_nil;
+    for (int j = argc - 1; j >= i; j--) {
+      rest = cons(argv[j], rest);
+    }
+    frame->slots[nreq + 1] = rest;
+  }
+
+  stats.closure_calls++;
+  size_t prof_base = prof_depth;
+  if (profiling) {
+    prof_enter(fun->expr, prof_base);
+  }
+  for (; CDR(body) != scm_nil; body = CDR(body)) {
+    eval(CAR(body), &frame);
+  }
+  /* the last form is in tail position, as it is in eval and the vm */
+  val = eval_at(CAR(body), &frame, prof_base);
+  prof_depth = prof_base;
+  return val;
+}
+
+/* evaluate an analyzed top-level form with the engine picked at startup */
+scm_object *execute(scm_object *obj) {
+  scm_object *toplevel = scm_nil;
+  return use_vm ? vm_run(compile(obj)) : eval(obj, &toplevel);
 }
 
-scm_object *user_interact(scm_object *obj, scm_object **env) {
-  return eval(eval(cons(expand_sym, cons(cons(quote_sym, cons(obj, scm_nil)), scm_nil)), env), env);
+scm_object *user_interact(scm_object *obj) {
+  return execute(analyze(expand(obj)));
 }
 
 int main(int argc, char *argv[]) {
+  gc_init(__builtin_frame_address(0));
   scm_init();
   int linum = 0, colnum = 0;
-
   scheme_input = stdin;
 
   for (int i = 1; i < argc; i++) {
-    pscm_load(cons(new_string(argv[i], strlen(argv[i])), scm_nil), &environment);
+    if (strcmp(argv[i], "--vm") == 0) {
+      use_vm = 1;
+      continue;
+    }
+    if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+      prof_start(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--image") == 0 && i + 1 < argc) {
+      image_load(argv[++i]);
+      continue;
+    }
+    if (strcmp(argv[i], "--dump-image") == 0 && i + 1 < argc) {
+      image_dump(argv[++i]);
+      exit(0);
+    }
+    scm_object *path = new_string(strdup(argv[i]), strlen(argv[i]));
+    pscm_load(1, &path);
   }
 
   for (;; linum++) {
     printf("> ");
+    fflush(stdout);
     if (peek() == EOF) {
       exit(0);
     }
-    scm_write(user_interact(scm_read(&linum, &colnum), &environment));
+    scm_write(user_interact(scm_read(&linum, &colnum)));
     putchar('\n');
   }
   exit(0);
@@ -14,27 +14,61 @@
 
 #define UNUSED __attribute__((unused))
 
-typedef struct obj *(*scm_proc)(struct obj *, struct obj **);
+typedef struct obj *(*scm_proc)(int argc, struct obj **argv);
+
+/* core primitives that eval and the vm run inline, see prim_inline in lib.h */
+enum prim_op {
+  PRIM_NONE,
+  PRIM_CAR,
+  PRIM_CDR,
+  PRIM_CONS,
+  PRIM_ADD,
+  PRIM_SUB,
+  PRIM_LT,
+  PRIM_EQ,
+  PRIM_EQV,
+  PRIM_NULL,
+  PRIM_PAIR
+};
+
+enum obj_tag {
+  SCHEME_INTEGER, // 0
+  SCHEME_TRUE, // 1
+  SCHEME_FALSE, // 2
+  SCHEME_NIL, // 3
+  SCHEME_CHARACTER, // 4
+  SCHEME_STRING, // 5
+  SCHEME_CONS, // 6
+  SCHEME_SYMBOL, // 7
+  SCHEME_CLOSURE, // 8
+  SCHEME_PROC, // 9
+  SCHEME_KNOT, // 10
+  SCHEME_FREE, // 11
+  SCHEME_FRAME, // 12
+  SCHEME_LOCAL, // 13
+  SCHEME_UNBOUND, // 14
+  SCHEME_CONTINUATION, // 15
+  SCHEME_BIGNUM, // 16
+  SCHEME_S32VECTOR, // 17
+  SCHEME_S64VECTOR, // 18
+  SCHEME_VECTOR, // 19
+  SCHEME_HASHTABLE, // 20
+  SCHEME_PORT // 21
+};
 
 typedef struct obj {
-  enum obj_tag {
-    SCHEME_INTEGER, // 0
-    SCHEME_TRUE, // 1
-    SCHEME_FALSE, // 2
-    SCHEME_NIL, // 3
-    SCHEME_CHARACTER, // 4
-    SCHEME_STRING, // 5
-    SCHEME_CONS, // 6
-    SCHEME_SYMBOL, // 7
-    SCHEME_CLOSURE, // 8
-    SCHEME_PROC, // 9
-    SCHEME_KNOT // 10
-  } tag;
+  unsigned char tag; /* enum obj_tag */
+  unsigned char mark;
+
+  /* symbols keep their hash and flags in the header so the cell stays small */
+  unsigned char sym_interned;
+  uint32_t sym_hash;
 
   union {
-    int32_t integer_value;
-    char char_value;
-    char *sym_value;
+    struct {
+      char *sym_value;
+      struct obj *sym_global; /* top-level value, or SCM_UNBOUND */
+    };
     struct {
       char *buffer;
       size_t length;
@@ -42,10 +76,29 @@ typedef struct obj {
     struct {
       struct obj *car, *cdr;
     };
+    struct {
+      void *vec_data; /* unboxed elements of a numeric vector */
+      size_t vec_len;
+    };
+    struct {
+      uint32_t *big_limbs; /* magnitude, least significant limb first */
+      uint32_t big_len;
+      int32_t big_sign;
+    };
     struct {
       struct obj *env, *expr;
     };
-    scm_proc procedure;
+    struct {
+      struct obj **slots; /* frames, vectors, a continuation's saved stack */
+      size_t nslots;
+    };
+    struct {
+      scm_proc procedure;
+      int16_t proc_min, proc_max; /* arity, checked by the caller */
+      unsigned char proc_op; /* enum prim_op */
+    };
+    struct hash_table *table;
+    struct port *port;
     struct obj *fwd;
   };
 } scm_object;
@@ -62,32 +115,119 @@ typedef struct obj {
 #define CADAR(X) CAR(CDAR(X))
 #define CADDDR(X) CAR(CDDDR(X))
 
-#define SCM_BOOL(x) ((x) ? scm_t : scm_f)
+/*
+ * Integers, characters, booleans and nil are immediates encoded in the
+ * pointer word itself and are never allocated. Heap cells are at least
+ * 8-byte aligned, so the low bits are free:
+ *
+ *   ...xxxxxxx1  integer (fixnum), value in the upper 63 bits
+ *   ...cccc0010  character c
+ *   ...tttt0110  constant with object tag t (#t, #f, (), unbound)
+ *   ...ssbd1010  analyzed local variable reference, see analyze.c
+ */
+#define IMM_CHAR  0x02
+#define IMM_CONST 0x06
+#define IMM_LOCAL 0x0a
+
+#define IS_IMMEDIATE(X) ((uintptr_t) (X) & 3)
+#define IS_INTEGER(X)   ((uintptr_t) (X) & 1)
+#define IS_CHAR(X)      (((uintptr_t) (X) & 0xff) == IMM_CHAR)
+#define IS_LOCAL(X)     (((uintptr_t) (X) & 0xff) == IMM_LOCAL)
+
+#define INT_VALUE(X)  ((intptr_t) (X) >> 1)
+#define CHAR_VALUE(X) ((char) ((uintptr_t) (X) >> 8))
+
+#define MAKE_CONST(T) ((scm_object *) (((uintptr_t) (T) << 8) | IMM_CONST))
+
+#define MAKE_LOCAL(DEPTH, SLOT, BOX) \
+  ((scm_object *) (((uintptr_t) (SLOT) << 10) | ((uintptr_t) (BOX) << 9) | ((uintptr_t) (DEPTH) << 8) | IMM_LOCAL))
+#define LOCAL_DEPTH(X) (((uintptr_t) (X) >> 8) & 1)
+#define LOCAL_BOX(X)   (((uintptr_t) (X) >> 9) & 1)
+#define LOCAL_SLOT(X)  ((uintptr_t) (X) >> 10)
+
+static inline enum obj_tag TAG(scm_object *o) {
+  uintptr_t bits = (uintptr_t) o;
+  if (bits & 1) {
+    return SCHEME_INTEGER;
+  } else if (bits & 2) {
+    switch (bits & 0xff) {
+      case IMM_CHAR: return SCHEME_CHARACTER;
+      case IMM_LOCAL: return SCHEME_LOCAL;
+      default: return (enum obj_tag) (bits >> 8);
+    }
+  }
+  return (enum obj_tag) o->tag;
+}
 
 /* global constants */
-scm_object *scm_t, *scm_f, *scm_nil;
+#define scm_t   MAKE_CONST(SCHEME_TRUE)
+#define scm_f   MAKE_CONST(SCHEME_FALSE)
+#define scm_nil MAKE_CONST(SCHEME_NIL)
+
+/* contents of a variable that hasn't been defined yet */
+#define SCM_UNBOUND MAKE_CONST(SCHEME_UNBOUND)
+
+#define SCM_BOOL(x) ((x) ? scm_t : scm_f)
 
-/* interpreter data structures */
-scm_object *symbol_table, *environment;
+/* proc_max of a procedure taking any number of arguments from proc_min up */
+#define ARITY_ANY -1
+
+static inline void check_arity(scm_object *proc, int argc) {
+  if (argc < proc->proc_min || (proc->proc_max != ARITY_ANY && argc > proc->proc_max)) {
+    if (proc->proc_max == ARITY_ANY) {
+      errx(1, "procedure expects at least %d arguments, got %d", proc->proc_min, argc);
+    }
+    if (proc->proc_min == proc->proc_max) {
+      errx(1, "procedure expects %d arguments, got %d", proc->proc_min, argc);
+    }
+    errx(1, "procedure expects %d to %d arguments, got %d", proc->proc_min, proc->proc_max, argc);
+  }
+}
 
 /* built-in symbols */
-scm_object *quote_sym, *define_sym, *lambda_sym, *if_sym, *expand_sym, *eof_sym, *quasiquote_sym, *unquote_sym;
+extern scm_object *quote_sym, *define_sym, *lambda_sym, *if_sym, *set_sym, *eof_sym, *quasiquote_sym, *unquote_sym;
+extern scm_object *begin_sym, *let_sym, *letrec_sym, *cond_sym, *case_sym, *else_sym, *arrow_sym;
 
 /* object tag to string */
 const char *tag_str(enum obj_tag tag);
 
+/* num must fit in a fixnum; make_integer in number.h promotes if it doesn't */
+static inline scm_object *new_integer(intptr_t num) {
+  return (scm_object *) (((uintptr_t) num << 1) | 1);
+}
+
+static inline scm_object *new_char(char c) {
+  return (scm_object *) (((uintptr_t) (unsigned char) c << 8) | IMM_CHAR);
+}
+
 /* allocation functions */
 scm_object *new(enum obj_tag);
-scm_object *new_integer(int);
-scm_object *new_char(char);
 scm_object *new_string(char *, int);
 scm_object *cons(scm_object *car, scm_object *cdr);
 scm_object *make_symbol(char *sym);
+scm_object *intern(const char *name, size_t len);
+scm_object *new_symbol(char *sym);
 scm_object *new_closure(scm_object *env, scm_object *expr);
+scm_object *new_frame(size_t nslots);
+scm_object *new_vector(size_t length, scm_object *fill);
+
+/* garbage collector */
+void gc_init(void *stack_bottom);
+void gc_root(scm_object **root);
+void gc_tracer(void (*tracer)(void));
+void gc_mark(scm_object *);
+void gc_collect(void);
+
+/* heap images, see image.c */
+void heap_adopt(scm_object *cells, size_t n);
+void each_symbol(void (*fn)(scm_object *));
+void reset_symbols(scm_object **syms, size_t n);
 
 /* interpreter entry points */
 scm_object *eval(scm_object *, scm_object **);
-scm_object *user_interact(scm_object *, scm_object **);
+scm_object *execute(scm_object *);
+scm_object *scm_apply(scm_object *, int argc, scm_object **argv);
+scm_object *user_interact(scm_object *);
 
 #endif /* SCHEME_H_ */
 
@@ -0,0 +1,97 @@
+#include "stats.h"
+#include "lib.h"
+#include "number.h"
+
+#include <inttypes.h>
+#include <time.h>
+
+/*
+ * Allocation and evaluation counters. new() counts cells by tag, the
+ * constructors add the payloads they malloc, and eval and the vm count steps
+ * and calls as they go. Setting PONZI_STATS prints the totals on exit.
+ */
+
+#define NTAGS (SCHEME_PORT + 1)
+
+struct scm_stats stats;
+
+static uint64_t total(const uint64_t *by_tag) {
+  uint64_t n = 0;
+  for (int t = 0; t < NTAGS; t++) {
+    n += by_tag[t];
+  }
+  return n;
+}
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_summary(void) {
+  fprintf(stderr, "stats: %" PRIu64 " steps, %" PRIu64 " closure calls, %" PRIu64 " primitive calls, %" PRIu64 " collections\n",
+      stats.steps, stats.closure_calls, stats.primitive_calls, stats.collections);
+  fprintf(stderr, "%14s %12s %14s\n", "allocated", "objects", "bytes");
+  for (int t = 0; t < NTAGS; t++) {
+    if (stats.objects[t]) {
+      fprintf(stderr, "%14s %12" PRIu64 " %14" PRIu64 "\n", tag_str(t), stats.objects[t], stats.bytes[t]);
+    }
+  }
+  fprintf(stderr, "%14s %12" PRIu64 " %14" PRIu64 "\n", "total", total(stats.objects), total(stats.bytes));
+}
+
+static scm_object *entry(const char *key, scm_object *val, scm_object *rest) {
+  return cons(cons(make_symbol((char *) key), val), rest);
+}
+
+/*
+ * (interpreter-stats) is an alist of the totals so far, with allocations
+ * as (tag objects bytes) lists for the tags that have any.
+ */
+static scm_object *pscm_interpreter_stats(UNUSED int argc, UNUSED scm_object **argv) {
+  struct scm_stats s = stats;
+  scm_object *by_tag = scm_nil;
+  for (int t = NTAGS; t-- > 0;) {
+    if (s.objects[t]) {
+      scm_object *counts = cons(make_integer(s.objects[t]), cons(make_integer(s.bytes[t]), scm_nil));
+      by_tag = cons(cons(make_symbol((char *) tag_str(t)), counts), by_tag);
+    }
+  }
+
+  scm_object *alist = entry("allocations", by_tag, scm_nil);
+  alist = entry("bytes", make_integer(total(s.bytes)), alist);
+  alist = entry("objects", make_integer(total(s.objects)), alist);
+  alist = entry("collections", make_integer(s.collections), alist);
+  alist = entry("primitive-calls", make_integer(s.primitive_calls), alist);
+  alist = entry("closure-calls", make_integer(s.closure_calls), alist);
+  return entry("steps", make_integer(s.steps), alist);
+}
+
+/* (time-apply thunk) calls thunk, reports what the call cost on stderr, and returns its value */
+static scm_object *pscm_time_apply(UNUSED int argc, scm_object **argv) {
+  struct scm_stats before = stats;
+  double start = now();
+
+  scm_object *val = scm_apply(argv[0], 0, NULL);
+
+  double elapsed = now() - start;
+  fprintf(stderr, "time: %.3f ms, %" PRIu64 " steps, %" PRIu64 " closure calls, %" PRIu64 " primitive calls, "
+      "%" PRIu64 " objects (%" PRIu64 " bytes), %" PRIu64 " collections\n",
+      elapsed * 1e3, stats.steps - before.steps,
+      stats.closure_calls - before.closure_calls, stats.primitive_calls - before.primitive_calls,
+      total(stats.objects) - total(before.objects),
+      total(stats.bytes) - total(before.bytes),
+      stats.collections - before.collections);
+  return val;
+}
+
+void stats_init(void) {
+  add_procedure("interpreter-stats", pscm_interpreter_stats, 0, 0);
+  add_procedure("time-apply", pscm_time_apply, 1, 1);
+
+  const char *env = getenv("PONZI_STATS");
+  if (env && *env && strcmp(env, "0") != 0) {
+    atexit(print_summary);
+  }
+}
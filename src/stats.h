@@ -0,0 +1,23 @@
+#ifndef STATS_H_
+#define STATS_H_
+
+#include "scheme.h"
+
+/*
+ * Running totals of what the interpreter has done since it started. They're
+ * only ever incremented; (time expr) and (interpreter-stats) work from
+ * snapshots.
+ */
+struct scm_stats {
+  uint64_t objects[SCHEME_PORT + 1]; /* heap cells handed out, by tag */
+  uint64_t bytes[SCHEME_PORT + 1]; /* those cells plus their malloc'd payloads */
+  uint64_t steps; /* eval calls, or vm instructions */
+  uint64_t closure_calls, primitive_calls;
+  uint64_t collections;
+};
+
+extern struct scm_stats stats;
+
+void stats_init(void);
+
+#endif /* STATS_H_ */
@@ -0,0 +1,727 @@
+#include "vm.h"
+#include "analyze.h"
+#include "lib.h"
+#include "profile.h"
+#include "stats.h"
+
+#include <setjmp.h>
+
+/*
+ * Bytecode compiler and virtual machine. Code is a frame of words: each
+ * instruction is an opcode (an integer immediate) followed by its operands,
+ * so the collector traces constants embedded in code like any other slot.
+ *
+ * The vm works on analyzed forms and shares closures and knots with eval;
+ * a lambda's body is compiled the first time the vm calls it. Since closures
+ * are flat and copy what they capture, a call frame never outlives its call
+ * and the vm keeps it on its own stack instead of allocating it.
+ *
+ * Scheme-to-Scheme calls don't recurse on the C stack. A call saves the
+ * caller's code, pc and frame below the callee's frame and the callee
+ * returns through them; a tail call reuses the caller's return point. The
+ * stack is malloc'd and grows on demand, so recursion depth is bounded by
+ * memory rather than by the C stack.
+ *
+ * Saved pcs and frame pointers are stored as offsets, which makes a stretch
+ * of stack relocatable: call/cc copies the stack of the current vm_run into
+ * a continuation, and calling the continuation copies it back.
+ */
+
+enum {
+  OP_CONST,         /* x         push x */
+  OP_LOCAL,         /* addr      push local variable */
+  OP_GLOBAL,        /* sym       push global variable */
+  OP_DEFINE_LOCAL,  /* addr      store top into local, leave it */
+  OP_SET_LOCAL,     /* addr      store top into local, replace it with #t */
+  OP_BIND_LOCAL,    /* addr      pop into the slot itself, even if it holds a knot */
+  OP_DEFINE_GLOBAL, /* sym       store top into global, leave it */
+  OP_SET_GLOBAL,    /* sym       store top into bound global, replace it with #t */
+  OP_CLOSURE,       /* lambda    push closure over the current frame */
+  OP_POP,           /*           drop top */
+  OP_JUMP,          /* target    jump */
+  OP_JUMP_FALSE,    /* target    pop, jump if it was #f */
+  OP_MEMV,          /* data      push whether a case clause with data takes top */
+  OP_CALL,          /* n         call stack[-n-1] with the n values above it */
+  OP_TAIL_CALL,     /* n         same, returning straight to our caller */
+  OP_RETURN,        /*           return top to the caller */
+  OP_COUNT
+};
+
+/* a code frame starts with the most operands its frame ever holds, and the lambda it's the body of or () */
+#define CODE_DEPTH  0
+#define CODE_LAMBDA 1
+#define CODE_START  2
+
+/* layout of a continuation's slots; the stack is copied from its run's base */
+#define K_CODE  0 /* code to resume, () to return from the run, #f if escape-only */
+#define K_PC    1
+#define K_FP    2 /* frame pointer, relative to the base */
+#define K_RUN   3 /* id of the activation that captured it */
+#define K_STACK 4
+
+#define VM_STACK_INITIAL (1 << 16)
+
+int use_vm;
+
+static scm_object **vm_stack;
+static size_t vm_sp, vm_stack_size;
+
+static void vm_trace(void) {
+  for (size_t i = 0; i < vm_sp; i++) {
+    gc_mark(vm_stack[i]);
+  }
+}
+
+static void vm_grow(size_t need) {
+  size_t size = vm_stack_size ? vm_stack_size : VM_STACK_INITIAL;
+  while (size < need) {
+    size *= 2;
+  }
+  if (size == vm_stack_size) {
+    return;
+  }
+  if (!(vm_stack = realloc(vm_stack, size * sizeof(*vm_stack)))) {
+    err(1, "failed to grow vm stack to %zu words", size);
+  }
+  if (!vm_stack_size) {
+    gc_tracer(vm_trace);
+  }
+  vm_stack_size = size;
+}
+
+/* continuations */
+
+/*
+ * An activation continuations can unwind to: every vm_run, and every
+ * call/cc made from C. A continuation whose activation is still live
+ * longjmps to it, discarding whatever C frames are in between.
+ */
+struct vm_ctx {
+  jmp_buf jb;
+  intptr_t id;
+  size_t base, prof_base; /* vm_sp and prof_depth when it started */
+  scm_object *k, *value; /* set by the thrower */
+  struct vm_ctx *prev;
+};
+
+static struct vm_ctx *vm_ctx;
+static intptr_t vm_ctx_count;
+
+static struct vm_ctx *find_ctx(scm_object *k) {
+  struct vm_ctx *ctx = vm_ctx;
+  while (ctx && ctx->id != INT_VALUE(k->slots[K_RUN])) {
+    ctx = ctx->prev;
+  }
+  return ctx;
+}
+
+_Noreturn void throw_to(scm_object *k, scm_object *value) {
+  struct vm_ctx *ctx = find_ctx(k);
+  if (!ctx) {
+    errx(1, "continuation called after its extent ended");
+  }
+  ctx->k = k;
+  ctx->value = value;
+  vm_ctx = ctx;
+  prof_unwind(ctx);
+  longjmp(ctx->jb, 1);
+}
+
+static scm_object *new_continuation(size_t nstack, intptr_t run) {
+  scm_object *k = new_frame(K_STACK + nstack);
+  k->tag = SCHEME_CONTINUATION;
+  k->slots[K_CODE] = scm_f;
+  k->slots[K_PC] = new_integer(0);
+  k->slots[K_FP] = new_integer(0);
+  k->slots[K_RUN] = new_integer(run);
+  return k;
+}
+
+/*
+ * The C side of call/cc, used when it's called from eval or from C. It can
+ * only make escaping continuations: they work until call/cc returns.
+ */
+scm_object *pscm_callcc(UNUSED int argc, scm_object **argv) {
+  struct vm_ctx ctx = { .id = ++vm_ctx_count, .base = vm_sp, .prof_base = prof_depth, .prev = vm_ctx };
+  scm_object *fun = argv[0], *k = new_continuation(0, ctx.id), *val;
+
+  vm_ctx = &ctx;
+  if (setjmp(ctx.jb)) {
+    val = ctx.value;
+  } else {
+    val = scm_apply(fun, 1, &k);
+  }
+  vm_sp = ctx.base;
+  prof_depth = ctx.prof_base;
+  vm_ctx = ctx.prev;
+  return val;
+}
+
+/* compiler */
+
+/* code is emitted straight into a frame, so the collector sees the constants */
+struct code_buf {
+  scm_object *code;
+  size_t n;
+  intptr_t depth, max_depth; /* operands on the stack at this point */
+};
+
+static void push_depth(struct code_buf *b, intptr_t n) {
+  b->depth += n;
+  if (b->depth > b->max_depth) {
+    b->max_depth = b->depth;
+  }
+}
+
+static size_t emit(struct code_buf *b, scm_object *word) {
+  scm_object *code = b->code;
+  if (b->n == code->nslots) {
+    size_t cap = code->nslots * 2;
+    if (!(code->slots = realloc(code->slots, cap * sizeof(*code->slots)))) {
+      err(1, "failed to grow code buffer");
+    }
+    while (code->nslots < cap) {
+      code->slots[code->nslots++] = scm_nil;
+    }
+  }
+  code->slots[b->n] = word;
+  return b->n++;
+}
+
+static size_t emit_op(struct code_buf *b, int op, scm_object *operand) {
+  emit(b, new_integer(op));
+  return emit(b, operand);
+}
+
+static void compile_expr(struct code_buf *, scm_object *, int tail);
+
+/* a list of forms, leaving or returning the value of the last */
+static void compile_sequence(struct code_buf *b, scm_object *body, int tail) {
+  for (; CDR(body) != scm_nil; body = CDR(body)) {
+    compile_expr(b, CAR(body), 0);
+    emit(b, new_integer(OP_POP));
+    b->depth--;
+  }
+  compile_expr(b, CAR(body), tail);
+}
+
+/* leaves one more operand on the stack, or returns it if tail is set */
+static void compile_expr(struct code_buf *b, scm_object *x, int tail) {
+  if (IS_LOCAL(x)) {
+    emit_op(b, OP_LOCAL, x);
+  } else if (TAG(x) == SCHEME_SYMBOL) {
+    emit_op(b, OP_GLOBAL, x);
+  } else if (TAG(x) != SCHEME_CONS) {
+    emit_op(b, OP_CONST, x);
+  } else if (CAR(x) == quote_sym) {
+    emit_op(b, OP_CONST, CADR(x));
+  } else if (CAR(x) == if_sym) {
+    compile_expr(b, CADR(x), 0);
+    size_t to_else = emit_op(b, OP_JUMP_FALSE, scm_nil);
+    b->depth--;
+    compile_expr(b, CADDR(x), tail);
+    size_t to_end = tail ? 0 : emit_op(b, OP_JUMP, scm_nil);
+    b->code->slots[to_else] = new_integer(b->n);
+    b->depth--;
+    compile_expr(b, TAG(CDDDR(x)) == SCHEME_CONS ? CADDDR(x) : scm_nil, tail);
+    if (!tail) {
+      b->code->slots[to_end] = new_integer(b->n);
+    }
+    return;
+  } else if (CAR(x) == define_sym || CAR(x) == set_sym) {
+    scm_object *name = CADR(x);
+    compile_expr(b, CADDR(x), 0);
+    b->depth--;
+    if (CAR(x) == define_sym) {
+      emit_op(b, IS_LOCAL(name) ? OP_DEFINE_LOCAL : OP_DEFINE_GLOBAL, name);
+    } else {
+      emit_op(b, IS_LOCAL(name) ? OP_SET_LOCAL : OP_SET_GLOBAL, name);
+    }
+  } else if (CAR(x) == lambda_sym) {
+    emit_op(b, OP_CLOSURE, x);
+  } else if (CAR(x) == begin_sym) {
+    compile_sequence(b, CDR(x), tail);
+    return;
+  } else if (CAR(x) == let_sym) {
+    for (scm_object *bindings = CADR(x); bindings != scm_nil; bindings = CDR(bindings)) {
+      compile_expr(b, CDAR(bindings), 0);
+      emit_op(b, OP_BIND_LOCAL, CAAR(bindings));
+      b->depth--;
+    }
+    compile_sequence(b, CDDR(x), tail);
+    return;
+  } else if (CAR(x) == case_sym) {
+    /* the key stays on the stack until a clause takes it */
+    scm_object *clauses = CDDR(x), *to_end = scm_nil;
+    compile_expr(b, CADR(x), 0);
+    for (; clauses != scm_nil && CAAR(clauses) != scm_t; clauses = CDR(clauses)) {
+      emit_op(b, OP_MEMV, CAAR(clauses));
+      push_depth(b, 1);
+      size_t to_next = emit_op(b, OP_JUMP_FALSE, scm_nil);
+      b->depth--;
+      emit(b, new_integer(OP_POP));
+      b->depth--;
+      compile_sequence(b, CDAR(clauses), tail);
+      if (!tail) {
+        to_end = cons(new_integer(emit_op(b, OP_JUMP, scm_nil)), to_end);
+      }
+      b->code->slots[to_next] = new_integer(b->n);
+    }
+    emit(b, new_integer(OP_POP));
+    b->depth--;
+    compile_sequence(b, clauses != scm_nil ? CDAR(clauses) : cons(scm_f, scm_nil), tail);
+    for (; to_end != scm_nil; to_end = CDR(to_end)) {
+      b->code->slots[INT_VALUE(CAR(to_end))] = new_integer(b->n);
+    }
+    return;
+  } else {
+    int argc = 0;
+    compile_expr(b, CAR(x), 0);
+    for (scm_object *args = CDR(x); args != scm_nil; args = CDR(args), argc++) {
+      compile_expr(b, CAR(args), 0);
+    }
+    emit_op(b, tail ? OP_TAIL_CALL : OP_CALL, new_integer(argc));
+    b->depth -= argc;
+    return;
+  }
+
+  push_depth(b, 1);
+  if (tail) {
+    emit(b, new_integer(OP_RETURN));
+  }
+}
+
+static void start(struct code_buf *b) {
+  b->code = new_frame(64);
+  b->n = 0;
+  b->depth = b->max_depth = 0;
+  emit(b, scm_nil);
+  emit(b, scm_nil);
+}
+
+static scm_object *finish(struct code_buf *b) {
+  b->code->slots[CODE_DEPTH] = new_integer(b->max_depth);
+  b->code->nslots = b->n;
+  return b->code;
+}
+
+/* compile an analyzed top-level form */
+scm_object *compile(scm_object *x) {
+  struct code_buf b;
+  start(&b);
+  compile_expr(&b, x, 1);
+  return finish(&b);
+}
+
+static scm_object *compile_lambda(scm_object *lambda) {
+  struct code_buf b;
+  start(&b);
+  b.code->slots[CODE_LAMBDA] = lambda;
+  compile_sequence(&b, CDDR(lambda), 1);
+  return CADR(lambda)->slots[LAMBDA_CODE] = finish(&b);
+}
+
+/* code that calls fun on args, for calls made from C */
+static scm_object *compile_apply(scm_object *fun, int argc, scm_object **argv) {
+  struct code_buf b;
+  start(&b);
+
+  emit_op(&b, OP_CONST, fun);
+  for (int i = 0; i < argc; i++) {
+    emit_op(&b, OP_CONST, argv[i]);
+  }
+  emit_op(&b, OP_TAIL_CALL, new_integer(argc));
+  b.max_depth = argc + 1;
+  return finish(&b);
+}
+
+/* interpreter */
+
+#if defined(__GNUC__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#define THREADED_DISPATCH 1
+#endif
+
+/* the profiler entries of a stack a continuation reinstated, one per closure frame */
+static void prof_frames(struct vm_ctx *ctx, scm_object *code, scm_object **fp) {
+  prof_depth = ctx->prof_base;
+  for (;;) {
+    if (code->slots[CODE_LAMBDA] != scm_nil) {
+      prof_push(CADR(code->slots[CODE_LAMBDA])->slots[LAMBDA_NAME]);
+    }
+    if (fp[-3] == scm_nil) {
+      break;
+    }
+    code = fp[-3];
+    fp -= INT_VALUE(fp[-1]);
+  }
+  for (size_t i = ctx->prof_base, j = prof_depth; i + 1 < j; i++, j--) {
+    scm_object *t = prof_stack[i];
+    prof_stack[i] = prof_stack[j - 1];
+    prof_stack[j - 1] = t;
+  }
+}
+
+/* run code, or if k is set, return val to it */
+static scm_object *interpret(struct vm_ctx *ctx, scm_object *code, scm_object *k, scm_object *val) {
+  scm_object **stack = vm_stack, **sp = stack + ctx->base, **fp = sp, **pc;
+  scm_object *fun, **slot;
+  intptr_t argc;
+  int tail;
+
+#define PUSH(X) (*sp++ = (X))
+#define POP() (*--sp)
+#define TOP() (sp[-1])
+#define OPERAND() (*pc++)
+#define SYNC() (vm_sp = sp - stack)
+/* make room for N more words above sp, wherever the stack ends up */
+#define RESERVE(N) do { \
+    if (sp + (N) > stack + vm_stack_size) { \
+      size_t sp_off = sp - stack, fp_off = fp - stack; \
+      vm_grow(sp_off + (N)); \
+      stack = vm_stack; \
+      sp = stack + sp_off; \
+      fp = stack + fp_off; \
+    } \
+  } while (0)
+
+  if (k) {
+    goto resume;
+  }
+
+  /* the return point of the top-level form: () in place of the caller's code */
+  PUSH(scm_nil);
+  PUSH(new_integer(0));
+  PUSH(new_integer(0));
+  fp = sp;
+  pc = code->slots + CODE_START;
+
+#ifdef THREADED_DISPATCH
+  static void *labels[OP_COUNT] = {
+    [OP_CONST] = &&op_CONST, [OP_LOCAL] = &&op_LOCAL, [OP_GLOBAL] = &&op_GLOBAL,
+    [OP_DEFINE_LOCAL] = &&op_DEFINE_LOCAL, [OP_SET_LOCAL] = &&op_SET_LOCAL,
+    [OP_BIND_LOCAL] = &&op_BIND_LOCAL,
+    [OP_DEFINE_GLOBAL] = &&op_DEFINE_GLOBAL, [OP_SET_GLOBAL] = &&op_SET_GLOBAL,
+    [OP_CLOSURE] = &&op_CLOSURE, [OP_POP] = &&op_POP, [OP_JUMP] = &&op_JUMP,
+    [OP_JUMP_FALSE] = &&op_JUMP_FALSE, [OP_MEMV] = &&op_MEMV, [OP_CALL] = &&op_CALL,
+    [OP_TAIL_CALL] = &&op_TAIL_CALL, [OP_RETURN] = &&op_RETURN
+  };
+#define CASE(OP) op_ ## OP
+#define NEXT() do { stats.steps++; goto *labels[INT_VALUE(*pc++)]; } while (0)
+#else
+#define CASE(OP) case OP_ ## OP
+#define NEXT() do { stats.steps++; goto dispatch; } while (0)
+#endif
+  NEXT();
+
+#ifndef THREADED_DISPATCH
+dispatch:
+  switch (INT_VALUE(*pc++)) {
+#endif
+
+  CASE(CONST):
+    PUSH(OPERAND());
+    NEXT();
+
+  CASE(LOCAL):
+    val = *local_slot(fp, OPERAND());
+    if (is_knot(val)) {
+      val = val->fwd;
+    }
+    if (val == SCM_UNBOUND) {
+      errx(1, "local variable referenced before its definition");
+    }
+    PUSH(val);
+    NEXT();
+
+  CASE(GLOBAL):
+    val = OPERAND();
+    if (val->sym_global == SCM_UNBOUND) {
+      errx(1, "no binding for symbol %s", val->sym_value);
+    }
+    PUSH(val->sym_global);
+    NEXT();
+
+  CASE(DEFINE_LOCAL):
+  CASE(SET_LOCAL):
+    slot = local_slot(fp, pc[0]);
+    if (is_knot(*slot)) {
+      slot = &(*slot)->fwd;
+    }
+    *slot = TOP();
+    if (INT_VALUE(pc[-1]) == OP_SET_LOCAL) {
+      TOP() = scm_t;
+    }
+    pc++;
+    NEXT();
+
+  CASE(BIND_LOCAL):
+    *local_slot(fp, OPERAND()) = POP();
+    NEXT();
+
+  CASE(DEFINE_GLOBAL):
+    OPERAND()->sym_global = TOP();
+    NEXT();
+
+  CASE(SET_GLOBAL):
+    val = OPERAND();
+    if (val->sym_global == SCM_UNBOUND) {
+      errx(1, "set!: no binding for symbol %s", val->sym_value);
+    }
+    val->sym_global = TOP();
+    TOP() = scm_t;
+    NEXT();
+
+  CASE(CLOSURE):
+    SYNC();
+    val = make_closure(OPERAND(), fp);
+    PUSH(val);
+    NEXT();
+
+  CASE(POP):
+    sp--;
+    NEXT();
+
+  CASE(JUMP):
+    pc = code->slots + INT_VALUE(pc[0]);
+    NEXT();
+
+  CASE(JUMP_FALSE):
+    if (POP() == scm_f) {
+      pc = code->slots + INT_VALUE(pc[0]);
+    } else {
+      pc++;
+    }
+    NEXT();
+
+  CASE(MEMV):
+    val = SCM_BOOL(case_matches(TOP(), OPERAND()));
+    PUSH(val);
+    NEXT();
+
+  /*
+   * A call frame lives on the stack: the return point (code, pc, distance to
+   * the caller's frame) sits just below it, then the closure's captured frame
+   * in slot 0, then the arguments, which are already in place, then the
+   * internal defines.
+   */
+  CASE(CALL):
+  CASE(TAIL_CALL):
+    tail = INT_VALUE(pc[-1]) == OP_TAIL_CALL;
+    argc = INT_VALUE(OPERAND());
+    fun = sp[-argc - 1];
+
+apply:
+    switch (TAG(fun)) {
+      case SCHEME_CLOSURE: ;
+        scm_object *info = CADR(fun->expr), *callee = info->slots[LAMBDA_CODE], **args;
+        intptr_t nreq = INT_VALUE(info->slots[LAMBDA_NREQ]),
+                 nslots = INT_VALUE(info->slots[LAMBDA_NSLOTS]), i;
+
+        if (callee == scm_nil) {
+          SYNC();
+          callee = compile_lambda(fun->expr);
+        }
+        RESERVE(3 + nslots + INT_VALUE(callee->slots[CODE_DEPTH]));
+
+        args = sp - argc - 1;
+        if (tail) {
+          memmove(fp, args, (argc + 1) * sizeof(*sp));
+        } else {
+          memmove(args + 3, args, (argc + 1) * sizeof(*sp));
+          args[0] = code;
+          args[1] = new_integer(pc - code->slots);
+          args[2] = new_integer(args + 3 - fp);
+          fp = args + 3;
+        }
+        sp = fp + argc + 1;
+
+        if (info->slots[LAMBDA_REST] == scm_t) {
+          scm_object *rest = scm_nil;
+          SYNC();
+          for (i = argc; i > nreq; i--) {
+            rest = cons(fp[i], rest);
+          }
+          /* required parameters that weren't passed */
+          for (i = argc + 1; i <= nreq; i++) {
+            fp[i] = SCM_UNBOUND;
+          }
+          fp[nreq + 1] = rest;
+          i = nreq + 2;
+        } else {
+          i = argc < nreq ? argc + 1 : nreq + 1;
+        }
+        for (; i < nslots; i++) {
+          fp[i] = SCM_UNBOUND;
+        }
+        fp[0] = fun->env;
+        sp = fp + nslots;
+
+        code = callee;
+        pc = code->slots + CODE_START;
+        stats.closure_calls++;
+        if (profiling) {
+          /* every closure frame has an entry, so the frame a tail call replaces has one unless it's the run's first */
+          prof_enter(fun->expr, tail && prof_depth > ctx->prof_base ? prof_depth - 1 : prof_depth);
+        }
+        NEXT();
+
+      case SCHEME_PROC:
+        stats.primitive_calls++;
+        if (fun->proc_op != PRIM_NONE && (argc == 1 || argc == 2)) {
+          SYNC();
+          if ((val = prim_inline(fun->proc_op, argc, sp - argc))) {
+            sp -= argc + 1;
+            PUSH(val);
+            if (tail) {
+              goto do_return;
+            }
+            NEXT();
+          }
+        }
+        check_arity(fun, argc);
+        if (fun->procedure == pscm_callcc) {
+          goto callcc;
+        }
+
+        /*
+         * The arguments are passed in a copy, since a primitive that reenters
+         * the vm may grow the stack and move them. They stay on the stack
+         * too, so they're traced during the call.
+         */
+        SYNC();
+        size_t sp_off = sp - stack - argc - 1, fp_off = fp - stack;
+        {
+          scm_object *argv[argc ? argc : 1];
+          memcpy(argv, sp - argc, argc * sizeof(*argv));
+          val = fun->procedure(argc, argv);
+        }
+
+        /* a primitive that reenters the vm may have moved the stack */
+        stack = vm_stack;
+        sp = stack + sp_off;
+        fp = stack + fp_off;
+        PUSH(val);
+        if (tail) {
+          goto do_return;
+        }
+        NEXT();
+
+      case SCHEME_CONTINUATION:
+        if (argc != 1) {
+          errx(1, "continuation expects 1 argument, got %d", (int) argc);
+        }
+        k = fun;
+        val = TOP();
+        if (k->slots[K_CODE] == scm_f || (INT_VALUE(k->slots[K_RUN]) != ctx->id && find_ctx(k))) {
+          throw_to(k, val);
+        }
+        /*
+         * Either ours, or its run has returned: then it's reinstated on
+         * ours, and finishing it returns from this run.
+         */
+        goto resume;
+
+      default: errx(1, "can't apply obj of type %s", tag_str(TAG(fun)));
+    }
+
+callcc:
+    /* capture the stack the value of (call/cc f) returns to, then call f */
+    SYNC();
+    {
+      scm_object **base = stack + ctx->base, **cut = tail ? fp - 3 : sp - argc - 1;
+      k = new_continuation(cut - base, ctx->id);
+      memcpy(k->slots + K_STACK, base, (cut - base) * sizeof(*sp));
+      if (tail) {
+        k->slots[K_CODE] = fp[-3];
+        k->slots[K_PC] = fp[-2];
+        k->slots[K_FP] = new_integer(fp - INT_VALUE(fp[-1]) - base);
+      } else {
+        k->slots[K_CODE] = code;
+        k->slots[K_PC] = new_integer(pc - code->slots);
+        k->slots[K_FP] = new_integer(fp - base);
+      }
+    }
+    fun = sp[-2] = sp[-1];
+    sp[-1] = k;
+    goto apply;
+
+resume:
+    /* reinstate k's stack on this run's base and return val to it */
+    {
+      size_t n = k->nslots - K_STACK;
+      code = k->slots[K_CODE];
+      sp = fp = stack + ctx->base;
+      RESERVE(n + 1 + (code == scm_nil ? 0 : INT_VALUE(code->slots[CODE_DEPTH])));
+      if (code == scm_nil) {
+        SYNC();
+        return val;
+      }
+      memcpy(sp, k->slots + K_STACK, n * sizeof(*sp));
+      sp += n;
+      fp = stack + ctx->base + INT_VALUE(k->slots[K_FP]);
+      pc = code->slots + INT_VALUE(k->slots[K_PC]);
+      if (profiling) {
+        prof_frames(ctx, code, fp);
+      }
+      PUSH(val);
+      NEXT();
+    }
+
+  CASE(RETURN):
+do_return:
+    if (profiling && prof_depth > ctx->prof_base) {
+      prof_depth--;
+    }
+    val = TOP();
+    sp = fp - 3;
+    if (sp[0] == scm_nil) {
+      SYNC();
+      return val;
+    }
+    code = sp[0];
+    pc = code->slots + INT_VALUE(sp[1]);
+    fp -= INT_VALUE(sp[2]);
+    PUSH(val);
+    NEXT();
+
+#ifndef THREADED_DISPATCH
+    default: errx(1, "bad opcode %d", (int) INT_VALUE(pc[-1]));
+  }
+#endif
+
+#undef PUSH
+#undef POP
+#undef TOP
+#undef OPERAND
+#undef SYNC
+#undef RESERVE
+#undef CASE
+#undef NEXT
+}
+
+#ifdef THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+scm_object *vm_run(scm_object *code) {
+  struct vm_ctx ctx = { .id = ++vm_ctx_count, .base = vm_sp, .prof_base = prof_depth, .prev = vm_ctx };
+  scm_object *val;
+
+  vm_grow(ctx.base + 3 + INT_VALUE(code->slots[CODE_DEPTH]));
+  vm_ctx = &ctx;
+  if (setjmp(ctx.jb)) {
+    /* a continuation of this run was called from further up the C stack */
+    val = interpret(&ctx, NULL, ctx.k, ctx.value);
+  } else {
+    val = interpret(&ctx, code, NULL, NULL);
+  }
+  prof_depth = ctx.prof_base;
+  vm_ctx = ctx.prev;
+  return val;
+}
+
+scm_object *vm_apply(scm_object *fun, int argc, scm_object **argv) {
+  return vm_run(compile_apply(fun, argc, argv));
+}
@@ -0,0 +1,17 @@
+#ifndef VM_H_
+#define VM_H_
+
+#include "scheme.h"
+
+/* set from the command line; selects the vm instead of the tree walker */
+extern int use_vm;
+
+scm_object *compile(scm_object *);
+scm_object *vm_run(scm_object *code);
+scm_object *vm_apply(scm_object *fun, int argc, scm_object **argv);
+
+/* call a continuation that has to unwind the C stack to get back to its run */
+_Noreturn void throw_to(scm_object *k, scm_object *value);
+scm_object *pscm_callcc(int argc, scm_object **argv);
+
+#endif /* VM_H_ */
@@ -0,0 +1,41 @@
+;;; fixnums are 63 bits; arithmetic that leaves that range promotes to a
+;;; bignum, and a result back in range is a fixnum again
+
+(define max 4611686018427387903)
+(define min -4611686018427387904)
+
+(define (check what got expected)
+  (if (not (= got expected))
+      (error what)))
+
+(check "bignum: max + 1" (+ max 1) 4611686018427387904)
+(check "bignum: min - 1" (- min 1) -4611686018427387905)
+(check "bignum: max + max + max" (+ max max max) 13835058055282163709)
+(check "bignum: - min" (- min) 4611686018427387904)
+(check "bignum: 0 - min" (- 0 min) 4611686018427387904)
+(check "bignum: max * 2" (* max 2) 9223372036854775806)
+(check "bignum: min * -1" (* min -1) 4611686018427387904)
+(check "bignum: max * max" (* max max) 21267647932558653957237540927630737409)
+(check "bignum: min / -1" (/ min -1) 4611686018427387904)
+(check "bignum: quotient rounds toward zero" (/ (- (* max 4)) 3) -6148914691236517204)
+
+;; fixnums are immediates, so only a result made a fixnum again is eq? to one
+(if (not (eq? (- (+ max 1) 1) max))
+    (error "bignum: max + 1 - 1 isn't the fixnum max"))
+(if (not (eq? (+ (- min 1) 1) min))
+    (error "bignum: min - 1 + 1 isn't the fixnum min"))
+(if (not (eq? (/ (* max 2) 2) max))
+    (error "bignum: max * 2 / 2 isn't the fixnum max"))
+(if (not (eq? (* (+ max 1) 0) 0))
+    (error "bignum: a bignum times 0 isn't the fixnum 0"))
+(if (not (eq? (- (* max max) (* max max)) 0))
+    (error "bignum: a bignum less itself isn't the fixnum 0"))
+
+(if (not (and (< max (+ max 1)) (> (+ max 1) max) (<= max (+ max 1)) (>= (+ max 1) max)))
+    (error "bignum: comparisons across max"))
+(if (not (and (> min (- min 1)) (< (- min 1) min) (>= min (- min 1)) (<= (- min 1) min)))
+    (error "bignum: comparisons across min"))
+(if (not (and (< (- min 1) max) (> (+ max 1) min) (< (- min 1) (+ max 1))))
+    (error "bignum: comparisons between bignums of either sign"))
+(if (or (= (+ max 1) max) (< (+ max 2) (+ max 1)) (= (+ max 1) (- min 1)))
+    (error "bignum: comparisons between unequal values"))
@@ -0,0 +1,67 @@
+;;; begin, let, letrec, cond and case, which the analyzer handles itself
+
+;; a local variable named like a core form shadows it
+(define (g let) (let 5))
+(if (not (= (g (lambda (x) (* x 2))) 10))
+    (error "core-forms: parameter didn't shadow let"))
+(define (h cond) (define (case x) (+ x 1)) (cond (case 1)))
+(if (not (= (h (lambda (x) (* x 3))) 6))
+    (error "core-forms: local didn't shadow cond or case"))
+(define (b begin) (let ((x 1)) (begin x)))
+(if (not (= (b (lambda (x) (+ x 10))) 11))
+    (error "core-forms: parameter didn't shadow begin"))
+
+;; named let and letrec, mutual recursion included
+(define (sum-to n) (let loop ((i 0) (acc 0)) (if (> i n) acc (loop (+ i 1) (+ acc i)))))
+(if (not (= (sum-to 100) 5050))
+    (error "core-forms: named let"))
+(define (parity n)
+  (letrec ((ev? (lambda (n) (if (= n 0) #t (od? (- n 1)))))
+           (od? (lambda (n) (if (= n 0) #f (ev? (- n 1))))))
+    (list (ev? n) (od? n))))
+(if (not (equal? (parity 7) '(#f #t)))
+    (error "core-forms: letrec"))
+(if (not (= (letrec ((fact (lambda (n) (if (= n 0) 1 (* n (fact (- n 1))))))) (fact 10)) 3628800))
+    (error "core-forms: letrec at top level"))
+
+;; cond with =>, which calls the procedure on the test's value
+(define (find x l) (if (null? l) #f (if (= (car (car l)) x) (car l) (find x (cdr l)))))
+(define (lookup-name x)
+  (cond ((find x '((1 . one) (2 . two))) => cdr)
+        ((> x 5) => (lambda (t) (list t x)))
+        (else 'none)))
+(if (not (equal? (map lookup-name '(1 2 7 3)) '(one two (#t 7) none)))
+    (error "core-forms: cond with =>"))
+(if (not (= (cond (#f => car) (5 => (lambda (v) (* v 2)))) 10))
+    (error "core-forms: cond with => at top level"))
+(define (arrow let) (cond ((+ 1 2) => let)))
+(if (not (= (arrow (lambda (v) (* v 10))) 30))
+    (error "core-forms: cond with => under a shadowed let"))
+
+;; case, with and without a matching clause
+(define (kind x)
+  (case x
+    ((1 2 3) 'small)
+    ((a b) 'letter)
+    (else 'other)))
+(if (not (equal? (map kind '(2 b 9 "s")) '(small letter other other)))
+    (error "core-forms: case with else"))
+(if (case 4 ((1 2) #t))
+    (error "core-forms: case without a match"))
+
+;; sibling lets share slots, but each makes fresh variables, so a closure
+;; keeps the value it captured after the next let reuses the slot
+(define (siblings)
+  (let ((get (let ((a 1)) (lambda () a))))
+    (let ((b 2))
+      (let ((c 3))
+        (list (get) b c)))))
+(if (not (equal? (siblings) '(1 2 3)))
+    (error "core-forms: a reused slot clobbered a captured variable"))
+(define (counters)
+  (let ((first (let ((n 0)) (lambda () (set! n (+ n 1)) n))))
+    (let ((second (let ((m 100)) (lambda () (set! m (+ m 1)) m))))
+      (first) (second)
+      (list (first) (second)))))
+(if (not (equal? (counters) '(2 102)))
+    (error "core-forms: captured variables in sibling lets"))
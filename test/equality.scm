@@ -0,0 +1,60 @@
+;;; eq? is identity, eqv? also compares numbers by value, and equal?
+;;; compares contents, cyclic ones included
+
+(define (check what got expected)
+  (if (not (eq? got expected))
+      (error what)))
+
+;; bignums are boxed, so two equal ones are eqv? but not eq?
+(define big (* 4611686018427387903 4))
+(define big2 (* 4611686018427387903 4))
+(check "equality: eq? on distinct bignums" (eq? big big2) #f)
+(check "equality: eq? on one bignum" (eq? big big) #t)
+(check "equality: eqv? on equal bignums" (eqv? big big2) #t)
+(check "equality: eqv? on different bignums" (eqv? big (+ big2 1)) #f)
+(check "equality: equal? on bignums" (equal? (list big) (list big2)) #t)
+(check "equality: eqv? on fixnums" (eqv? 7 7) #t)
+(check "equality: eqv? on characters" (eqv? #\a #\a) #t)
+
+;; strings are compared by contents only by equal?
+(define s1 "ponzi")
+(define s2 "ponzi")
+(check "equality: eq? on distinct strings" (eq? s1 s2) #f)
+(check "equality: eqv? on distinct strings" (eqv? s1 s2) #f)
+(check "equality: equal? on equal strings" (equal? s1 s2) #t)
+(check "equality: equal? on different strings" (equal? s1 "ponz") #f)
+
+;; vectors too, nested ones and lengths included
+(define v1 (vector 1 "two" (vector 3 big)))
+(define v2 (vector 1 "two" (vector 3 big2)))
+(check "equality: eqv? on distinct vectors" (eqv? v1 v2) #f)
+(check "equality: equal? on equal vectors" (equal? v1 v2) #t)
+(check "equality: equal? on vectors of different lengths" (equal? (vector 1 2) (vector 1 2 3)) #f)
+(check "equality: equal? on a vector and a list" (equal? (vector 1 2) (list 1 2)) #f)
+(vector-set! (vector-ref v2 2) 0 4)
+(check "equality: equal? on different vectors" (equal? v1 v2) #f)
+
+;; a long list doesn't use the C stack
+(define (build n acc) (if (= n 0) acc (build (- n 1) (cons n acc))))
+(check "equality: equal? on long lists" (equal? (build 100000 '()) (build 100000 '())) #t)
+(check "equality: equal? on long different lists"
+       (equal? (build 100000 '()) (build 100000 '(0))) #f)
+
+;; cycles end, whether they're equal or not
+(define (ring a b c)
+  (let ((l (list a b c)))
+    (set-cdr! (cdr (cdr l)) l)
+    l))
+(define r1 (ring 1 2 3))
+(define r2 (ring 1 2 3))
+(check "equality: eq? on distinct cycles" (eq? r1 r2) #f)
+(check "equality: equal? on one cycle" (equal? r1 r1) #t)
+(check "equality: equal? on equal cycles" (equal? r1 r2) #t)
+(check "equality: equal? on different cycles" (equal? r1 (ring 1 2 4)) #f)
+(define c1 (vector 0 #f))
+(vector-set! c1 1 c1)
+(define c2 (vector 0 #f))
+(vector-set! c2 1 c2)
+(check "equality: equal? on cycles through vectors" (equal? c1 c2) #t)
+(vector-set! c2 0 1)
+(check "equality: equal? on different cycles through vectors" (equal? c1 c2) #f)
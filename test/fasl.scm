@@ -0,0 +1,45 @@
+;;; fasl: round-tripping shared and cyclic data, and tables large enough
+;;; to grow while fasl-read fills them
+
+(define (round-trip x)
+  (define out (open-file "test.fasl" #\w))
+  (fasl-write x out)
+  (close-file out)
+  (let ((in (open-file "test.fasl" #\r)))
+    (fasl-read in)))
+
+(define shared (list 'x "s"))
+(define cycle (list 1 2 3))
+(set-cdr! (cdr (cdr cycle)) cycle)
+
+(define eq-table (make-eq-hash-table))
+(define equal-table (make-equal-hash-table))
+(hash-table-set! eq-table 'self eq-table)
+(let loop ((i 0))
+  (if (< i 40)
+      (begin
+        (hash-table-set! eq-table i shared)
+        (hash-table-set! equal-table (list i "key") (* i 100000000000000000000))
+        (loop (+ i 1)))))
+
+(define d (round-trip (vector shared shared cycle eq-table equal-table)))
+
+(if (not (eq? (vector-ref d 0) (vector-ref d 1)))
+    (error "fasl: sharing lost"))
+(if (not (eq? (vector-ref d 2) (cdr (cdr (cdr (vector-ref d 2))))))
+    (error "fasl: cycle lost"))
+
+(define t (vector-ref d 3))
+(if (not (and (= (hash-table-size t) 41)
+              (eq? (hash-table-ref/default t 'self #f) t)
+              (eq? (hash-table-ref/default t 39 #f) (vector-ref d 0))))
+    (error "fasl: eq table wrong"))
+
+(define u (vector-ref d 4))
+(if (not (= (hash-table-size u) 40))
+    (error "fasl: equal table wrong size"))
+(let loop ((i 0))
+  (if (< i 40)
+      (if (equal? (hash-table-ref/default u (list i "key") #f) (* i 100000000000000000000))
+          (loop (+ i 1))
+          (error "fasl: equal table lost entries"))))
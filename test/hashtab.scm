@@ -0,0 +1,53 @@
+;;; hash tables: growing through hash-table-set! and through the inserts
+;;; fasl-read makes from C, which don't drain a resize as they go
+
+(define n 1000)
+
+(define (fill! table key)
+  (let loop ((i 0))
+    (if (< i n)
+        (begin (hash-table-set! table (key i) i) (loop (+ i 1))))))
+
+(define (check table key what)
+  (if (not (= (hash-table-size table) n))
+      (error what))
+  (let loop ((i 0))
+    (if (< i n)
+        (if (= (hash-table-ref/default table (key i) -1) i)
+            (loop (+ i 1))
+            (error what)))))
+
+(define (round-trip x)
+  (define out (open-file "hashtab.fasl" #\w))
+  (fasl-write x out)
+  (close-file out)
+  (let ((in (open-file "hashtab.fasl" #\r)))
+    (fasl-read in)))
+
+(define (fixnum-key i) i)
+(define (bignum-key i) (* (+ i 1) 100000000000000000000))
+(define (list-key i) (list i "key" #\k))
+
+(define eq-table (make-eq-hash-table))
+(define eqv-table (make-eqv-hash-table))
+(define equal-table (make-equal-hash-table))
+(fill! eq-table fixnum-key)
+(fill! eqv-table bignum-key)
+(fill! equal-table list-key)
+
+(check eq-table fixnum-key "hashtab: eq table lost entries")
+(check eqv-table bignum-key "hashtab: eqv table lost entries")
+(check equal-table list-key "hashtab: equal table lost entries")
+
+(check (round-trip eq-table) fixnum-key "hashtab: read eq table lost entries")
+(check (round-trip eqv-table) bignum-key "hashtab: read eqv table lost entries")
+(check (round-trip equal-table) list-key "hashtab: read equal table lost entries")
+
+;; deleting half and growing again reuses the tombstones
+(let loop ((i 0))
+  (if (< i n)
+      (begin (hash-table-delete! equal-table (list-key i)) (loop (+ i 2)))))
+(if (not (= (hash-table-size equal-table) (/ n 2)))
+    (error "hashtab: wrong size after deletes"))
+(fill! equal-table list-key)
+(check equal-table list-key "hashtab: equal table lost entries after deletes")
@@ -0,0 +1,22 @@
+# images: a heap dumped with a table large enough to grow on restore
+
+cat > table.scm <<'SCM'
+(define table (make-equal-hash-table))
+(define (key i) (list i "key"))
+(let loop ((i 0))
+  (if (< i 100)
+      (begin (hash-table-set! table (key i) i) (loop (+ i 1)))))
+SCM
+
+cat > check.scm <<'SCM'
+(if (not (= (hash-table-size table) 100))
+    (error "image: table wrong size"))
+(let loop ((i 0))
+  (if (< i 100)
+      (if (= (hash-table-ref/default table (key i) -1) i)
+          (loop (+ i 1))
+          (error "image: table lost entries"))))
+SCM
+
+"$PONZI" $ENGINE "$LIB" table.scm --dump-image table.img </dev/null >/dev/null &&
+"$PONZI" $ENGINE --image table.img check.scm </dev/null >/dev/null
@@ -0,0 +1,47 @@
+;;; s32 and s64 vectors
+
+;; the printed #s32(...) and #s64(...) forms read back
+(if (not (equal? (s32vector->list #s32(7 -7 2147483647 -2147483648)) '(7 -7 2147483647 -2147483648)))
+    (error "numvec: #s32 literal read wrong"))
+(if (not (equal? (s64vector->list '#s64(9223372036854775807 -9223372036854775808)) '(9223372036854775807 -9223372036854775808)))
+    (error "numvec: #s64 literal read wrong"))
+(if (not (= (s32vector-length #s32()) 0))
+    (error "numvec: empty #s32 literal read wrong"))
+
+(define out (open-file "numvec.txt" #\w))
+(write-string "(#s32(1 -2) #s64(3))" out)
+(close-file out)
+(define in (open-file "numvec.txt" #\r))
+(define d (read in))
+(if (not (and (equal? (s32vector->list (car d)) '(1 -2))
+              (equal? (s64vector->list (car (cdr d))) '(3))))
+    (error "numvec: #s32 and #s64 read from a port wrong"))
+
+;; sums and dot products are exact, past 32 and past 64 bits
+(define s32max 2147483647)
+(define s32min -2147483648)
+(define s64max 9223372036854775807)
+(define s64min -9223372036854775808)
+(define (repeat x n) (let loop ((n n) (acc '())) (if (= n 0) acc (loop (- n 1) (cons x acc)))))
+
+(if (not (= (s32vector-sum (s32vector s32max s32max s32max)) 6442450941))
+    (error "numvec: s32 sum past 32 bits"))
+(if (not (= (s32vector-sum (list->s32vector (repeat s32min 1001))) -2149631131648))
+    (error "numvec: long s32 sum past 32 bits"))
+(if (not (= (s32vector-dot (s32vector s32min s32min) (s32vector s32min s32min)) 9223372036854775808))
+    (error "numvec: s32 dot past 64 bits"))
+(if (not (= (s32vector-dot (s32vector s32max s32min) (s32vector s32max s32max)) -2147483647))
+    (error "numvec: s32 dot with mixed signs"))
+
+(if (not (= (s64vector-sum (s64vector s64max s64max)) 18446744073709551614))
+    (error "numvec: s64 sum past 64 bits"))
+(if (not (= (s64vector-sum (s64vector s64min -1)) -9223372036854775809))
+    (error "numvec: s64 sum below 64 bits"))
+(if (not (= (s64vector-sum (s64vector s64max 1 -2)) 9223372036854775806))
+    (error "numvec: s64 sum back within 64 bits"))
+(if (not (= (s64vector-dot (s64vector s64max 2) (s64vector s64max 3)) 85070591730234615847396907784232501255))
+    (error "numvec: s64 dot with an overflowing product"))
+(if (not (= (s64vector-dot (s64vector 4611686018427387904 4611686018427387904) (s64vector 2 1)) 13835058055282163712))
+    (error "numvec: s64 dot with an overflowing sum"))
+(if (not (= (s64vector-dot (s64vector s64min) (s64vector -1)) 9223372036854775808))
+    (error "numvec: s64 dot of min and -1"))
@@ -0,0 +1,30 @@
+# profiling: a tail call replaces its caller's entry in both engines, and
+# escaping from (profile thunk) stops the sampling
+
+cat > tail.scm <<'SCM'
+(define (loop n) (if (= n 0) 0 (loop (- n 1))))
+(define (main) (loop 10) (loop 1000000))
+(profile main)
+SCM
+
+"$PONZI" $ENGINE "$LIB" tail.scm </dev/null >/dev/null 2>&1 || exit 1
+if grep -q 'main;loop' ponzi.prof; then
+  echo "a tail call from main kept main's entry:"
+  cat ponzi.prof
+  exit 1
+fi
+rm -f ponzi.prof
+
+cat > escape.scm <<'SCM'
+(define (spin n) (if (= n 0) 0 (spin (- n 1))))
+(call/cc (lambda (k) (profile (lambda () (spin 100000) (k 0)))))
+(define (after n) (if (= n 0) 0 (after (- n 1))))
+(after 2000000)
+SCM
+
+"$PONZI" $ENGINE "$LIB" escape.scm </dev/null >/dev/null 2>&1 || exit 1
+if [ -f ponzi.prof ] && grep -q after ponzi.prof; then
+  echo "sampling went on after escaping from profile:"
+  cat ponzi.prof
+  exit 1
+fi
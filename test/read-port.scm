@@ -0,0 +1,55 @@
+;;; read from a port, with data that straddle the port's buffer refills
+
+(define out (open-file "read-port.txt" #\w))
+(define (times n s)
+  (if (> n 0) (begin (write-string s out) (times (- n 1) s))))
+
+;; a flat list much longer than one buffer
+(write-string "(" out)
+(times 20000 "123456789 ")
+(write-string ")" out)
+;; many small data, whose tokens fall across the refills at varied offsets
+(times 500 " (entry \"a string\" symbol #\\a -42 #(1 2))")
+;; a string longer than a buffer
+(write-string " \"" out)
+(times 1000 "abcdefghij")
+(write-string "\"" out)
+;; nesting deeper than a buffer is long
+(write-string " " out)
+(times 5000 "(")
+(write-string "x" out)
+(times 5000 ")")
+(close-file out)
+
+(define in (open-file "read-port.txt" #\r))
+
+(define (check-list l n)
+  (if (= n 0)
+      (if (not (null? l)) (error "read-port: flat list too long"))
+      (if (and (pair? l) (= (car l) 123456789))
+          (check-list (cdr l) (- n 1))
+          (error "read-port: flat list read wrong"))))
+(check-list (read in) 20000)
+
+(define (check-entries n)
+  (if (> n 0)
+      (if (equal? (read in) '(entry "a string" symbol #\a -42 #(1 2)))
+          (check-entries (- n 1))
+          (error "read-port: entry read wrong"))))
+(check-entries 500)
+
+(define long (read in))
+(if (not (and (string? long) (= (string-len long) 10000)
+              (eq? (string-ref long 0) #\a) (eq? (string-ref long 9999) #\j)))
+    (error "read-port: long string read wrong"))
+
+(define (depth x n)
+  (if (pair? x)
+      (if (null? (cdr x)) (depth (car x) (+ n 1)) (error "read-port: nested list read wrong"))
+      (if (eq? x 'x) n (error "read-port: nested list read wrong"))))
+(if (not (= (depth (read in) 0) 5000))
+    (error "read-port: nested list has the wrong depth"))
+
+(if (not (and (eq? (read in) 'EOF) (eq? (read in) 'EOF)))
+    (error "read-port: no EOF after the last datum"))
+(close-file in)
@@ -0,0 +1,19 @@
+;;; primitives that call back into scheme: the callback grows the vm stack
+;;; while the primitive still holds its arguments
+
+(define (deep n)
+  (if (= n 0)
+      0
+      (+ 1 (deep (- n 1)))))
+
+(define table (make-eqv-hash-table))
+(hash-table-set! table 1 2)
+(hash-table-set! table 3 4)
+
+(define total 0)
+(hash-table-walk table (lambda (k v) (set! total (+ total (deep 20000) k v))))
+(if (not (= total 40010))
+    (error "reenter: hash-table-walk lost its arguments"))
+
+(if (not (= (apply (lambda (a b) (+ (deep 20000) a b)) 1 (list 2)) 20003))
+    (error "reenter: apply lost its arguments"))
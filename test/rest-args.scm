@@ -0,0 +1,12 @@
+;;; rest parameters: a call short of the required arguments leaves them
+;;; unbound rather than bound to whatever was on the vm stack
+;;; error: local variable referenced before its definition
+
+(define (f a b . r) (list a b r))
+
+(if (not (equal? (f 1 2) '(1 2 ())))
+    (error "rest-args: no rest arguments"))
+(if (not (equal? (f 1 2 3 4) '(1 2 (3 4))))
+    (error "rest-args: rest arguments lost"))
+
+(f 1)
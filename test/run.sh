@@ -0,0 +1,59 @@
+#!/bin/sh
+#
+# test/run.sh PONZI
+#
+# Runs every test in test/ under both engines, in a scratch directory. A
+# .scm test is loaded after lib.scm and passes if it exits cleanly, or, if
+# it has an ";;; error: MESSAGE" line, if it fails with MESSAGE on stderr.
+# A .sh test is run with PONZI, LIB and ENGINE (empty or --vm) in its
+# environment and passes if it exits cleanly.
+
+if [ $# -lt 1 ]; then
+  echo "usage: $0 PONZI" >&2
+  exit 2
+fi
+
+case $1 in
+  /*) PONZI=$1 ;;
+  *) PONZI=$PWD/$1 ;;
+esac
+test=$(cd "$(dirname "$0")" && pwd)
+LIB=$(dirname "$test")/lib.scm
+export PONZI LIB
+
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+cd "$scratch"
+
+failed=0
+for t in "$test"/*.scm "$test"/*.sh; do
+  name=$(basename "$t")
+  if [ "$name" = run.sh ] || [ ! -f "$t" ]; then
+    continue
+  fi
+  for ENGINE in "" --vm; do
+    export ENGINE
+    case $name in
+      *.sh) timeout 60 sh "$t" >out 2>&1; status=$? ;;
+      *) timeout 60 "$PONZI" $ENGINE "$LIB" "$t" </dev/null >out 2>&1; status=$? ;;
+    esac
+    expected=$(sed -n 's/^;;; error: //p' "$t")
+    if [ -n "$expected" ]; then
+      [ $status -ne 0 ] && grep -qF "$expected" out
+    else
+      [ $status -eq 0 ]
+    fi
+    if [ $? -eq 0 ]; then
+      echo "ok   $name ${ENGINE:-eval}"
+    else
+      echo "FAIL $name ${ENGINE:-eval}"
+      sed 's/^/  /' out
+      failed=$((failed + 1))
+    fi
+  done
+done
+
+if [ $failed -ne 0 ]; then
+  echo "$failed failed"
+  exit 1
+fi
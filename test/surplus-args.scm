@@ -0,0 +1,12 @@
+;;; closures called with more arguments than they take: the extra ones are
+;;; dropped, but both engines still evaluate them, left to right
+
+(define trace '())
+(define (note x) (set! trace (cons x trace)) x)
+
+(define (f x) x)
+
+(if (not (= (f (note 1) (note 2) (note 3)) 1))
+    (error "surplus-args: wrong value"))
+(if (not (equal? trace '(3 2 1)))
+    (error "surplus-args: extra arguments not evaluated"))
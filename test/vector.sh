@@ -0,0 +1,31 @@
+# vectors: an index outside 0..length-1 is an error, not a stray read or write
+
+cat > ok.scm <<'SCM'
+(define v (make-vector 3 0))
+(vector-set! v 0 'first)
+(vector-set! v 2 'last)
+(if (not (equal? (list (vector-ref v 0) (vector-ref v 1) (vector-ref v 2)) '(first 0 last)))
+    (error "vector: in-bounds access went wrong"))
+(if (not (= (vector-length (make-vector 0)) 0))
+    (error "vector: empty vector has a length"))
+SCM
+"$PONZI" $ENGINE "$LIB" ok.scm </dev/null >/dev/null || exit 1
+
+fails() {
+  printf "(define v (vector 1 2 3)) %s\n" "$1" >case.scm
+  if "$PONZI" $ENGINE "$LIB" case.scm </dev/null >case.out 2>&1 || ! grep -qF "$2" case.out; then
+    echo "$1 should have failed with: $2"
+    cat case.out
+    exit 1
+  fi
+}
+
+fails "(vector-ref v 3)" "vector-ref: index out of bounds"
+fails "(vector-ref v -1)" "vector-ref: index out of bounds"
+fails "(vector-ref v 4611686018427387904)" "vector-ref: index out of bounds"
+fails "(vector-ref v #\\a)" "vector-ref: index out of bounds"
+fails "(vector-ref (make-vector 0) 0)" "vector-ref: index out of bounds"
+fails "(vector-set! v 3 0)" "vector-set!: index out of bounds"
+fails "(vector-set! v -1 0)" "vector-set!: index out of bounds"
+fails "(vector-ref '(1 2 3) 0)" "vector-ref: expected vector, got pair"
+fails "(make-vector -1)" "make-vector: bad length"
@@ -0,0 +1,26 @@
+;;; ports: a port opened with #\+ reads and writes at one offset, and one
+;;; opened with #\w is write-only, so reading from it is an error rather
+;;; than an empty file
+;;; error: read-char: port is not open for reading
+
+(define out (open-file "both.txt" #\w))
+(write-string "abcdef" out)
+(close-file out)
+
+(define both (open-file "both.txt" #\+))
+(if (not (eqv? (read-char both) #\a))
+    (error "write-port: wrong first char"))
+(write-char #\X both)
+(if (not (eqv? (read-char both) #\c))
+    (error "write-port: read after a write skipped ahead"))
+(write-char #\Y both)
+(close-file both)
+
+(define in (open-file "both.txt" #\r))
+(if (not (equal? (read-line in) "aXcYef"))
+    (error "write-port: writes went to the wrong place"))
+(close-file in)
+
+(define out (open-file "write-port.txt" #\w))
+(write-char #\a out)
+(read-char out)
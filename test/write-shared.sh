@@ -0,0 +1,47 @@
+# datum labels: write-shared labels all shared pairs and vectors, write
+# only those on a cycle, and write-simple none
+
+cat > shared.scm <<'SCM'
+(define (show x) (write-shared x) (write #\newline))
+(define l (list 1 2))
+(set-cdr! (cdr l) l)
+(show l)
+(define a (list 'x))
+(define b (list 'y))
+(show (list a b a b))
+(define c (list 1))
+(set-car! c c)
+(show c)
+(define v (vector 1 2))
+(vector-set! v 1 v)
+(show v)
+(define tail (list 1 2 3))
+(set-cdr! (cdr (cdr tail)) (cdr tail))
+(show tail)
+(show (list 1 (vector 2 3) "four"))
+(write (list a b a b))
+(write #\newline)
+(write tail)
+(write #\newline)
+(write-simple (list a a))
+(write #\newline)
+SCM
+
+cat > expected <<'OUT'
+#0=(1 2 . #0#)
+(#0=(x) #1=(y) #0# #1#)
+#0=(#0#)
+#0=#(1 #0#)
+(1 . #0=(2 3 . #0#))
+(1 #(2 3) "four")
+((x) (y) (x) (y))
+(1 . #0=(2 3 . #0#))
+((x) (x))
+OUT
+
+"$PONZI" $ENGINE "$LIB" shared.scm </dev/null >printed || exit 1
+head -n 9 printed >got
+if ! cmp -s expected got; then
+  diff expected got
+  exit 1
+fi